@@ -18,6 +18,18 @@ typedef int blasbool;
 #define FALSE 0
 #define TRUE  1
 
+/* The unit-stride loops of ddot, daxpy, dnrm2 and dscal have AVX2 and
+   AVX-512 versions, compiled with GCC's target attribute and chosen at
+   run time from what the CPU supports (see simd.c). Elsewhere only the
+   reference loops are built. */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BLAS_X86_SIMD
+#include <immintrin.h>
+#endif
+
+enum { BLAS_GENERIC, BLAS_AVX2, BLAS_AVX512 };
+int blas_simd_level(void);
+
 /* Macro functions */
 #define MIN(a,b) ((a) <= (b) ? (a) : (b))
 #define MAX(a,b) ((a) >= (b) ? (a) : (b))
@@ -1,5 +1,49 @@
 #include "blas.h"
 
+#ifdef BLAS_X86_SIMD
+/* No FMA here, not even by contraction: sy[i] + ssa*sx[i] is rounded as
+   in the loop below, so the result does not depend on the CPU. */
+__attribute__((target("avx512f"), optimize("fp-contract=off")))
+static void daxpy_avx512(long int n, double ssa, double *sx, double *sy)
+{
+  long int i;
+  __m512d a = _mm512_set1_pd(ssa);
+
+  for (i = 0; i+16 <= n; i += 16)
+  {
+    __m512d y0 = _mm512_add_pd(_mm512_loadu_pd(sy+i), _mm512_mul_pd(a, _mm512_loadu_pd(sx+i)));
+    __m512d y1 = _mm512_add_pd(_mm512_loadu_pd(sy+i+8), _mm512_mul_pd(a, _mm512_loadu_pd(sx+i+8)));
+    _mm512_storeu_pd(sy+i, y0);
+    _mm512_storeu_pd(sy+i+8, y1);
+  }
+  for ( ; i+8 <= n; i += 8)
+    _mm512_storeu_pd(sy+i, _mm512_add_pd(_mm512_loadu_pd(sy+i), _mm512_mul_pd(a, _mm512_loadu_pd(sx+i))));
+  if (i < n)
+  {
+    __mmask8 k = (__mmask8)((1u << (n-i)) - 1);
+    __m512d y = _mm512_add_pd(_mm512_maskz_loadu_pd(k, sy+i), _mm512_mul_pd(a, _mm512_maskz_loadu_pd(k, sx+i)));
+    _mm512_mask_storeu_pd(sy+i, k, y);
+  }
+}
+
+__attribute__((target("avx2"), optimize("fp-contract=off")))
+static void daxpy_avx2(long int n, double ssa, double *sx, double *sy)
+{
+  long int i;
+  __m256d a = _mm256_set1_pd(ssa);
+
+  for (i = 0; i+8 <= n; i += 8)
+  {
+    __m256d y0 = _mm256_add_pd(_mm256_loadu_pd(sy+i), _mm256_mul_pd(a, _mm256_loadu_pd(sx+i)));
+    __m256d y1 = _mm256_add_pd(_mm256_loadu_pd(sy+i+4), _mm256_mul_pd(a, _mm256_loadu_pd(sx+i+4)));
+    _mm256_storeu_pd(sy+i, y0);
+    _mm256_storeu_pd(sy+i+4, y1);
+  }
+  for ( ; i < n; i++)
+    sy[i] += ssa * sx[i];
+}
+#endif
+
 int daxpy_(int *n, double *sa, double *sx, int *incx, double *sy,
            int *incy)
 {
@@ -21,6 +65,18 @@ int daxpy_(int *n, double *sa, double *sx, int *incx, double *sy,
   {
     if (iincx == 1 && iincy == 1) /* code for both increments equal to 1 */
     {
+#ifdef BLAS_X86_SIMD
+      if (blas_simd_level() == BLAS_AVX512)
+      {
+        daxpy_avx512(nn, ssa, sx, sy);
+        return 0;
+      }
+      if (blas_simd_level() == BLAS_AVX2)
+      {
+        daxpy_avx2(nn, ssa, sx, sy);
+        return 0;
+      }
+#endif
       m = nn-3;
       for (i = 0; i < m; i += 4)
       {
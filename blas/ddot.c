@@ -1,5 +1,59 @@
 #include "blas.h"
 
+#ifdef BLAS_X86_SIMD
+/* Four sums are kept so that the FMAs do not wait on each other. */
+__attribute__((target("avx512f")))
+static double ddot_avx512(long int n, double *sx, double *sy)
+{
+  long int i;
+  __m512d s0 = _mm512_setzero_pd(), s1 = _mm512_setzero_pd();
+  __m512d s2 = _mm512_setzero_pd(), s3 = _mm512_setzero_pd();
+
+  for (i = 0; i+32 <= n; i += 32)
+  {
+    s0 = _mm512_fmadd_pd(_mm512_loadu_pd(sx+i), _mm512_loadu_pd(sy+i), s0);
+    s1 = _mm512_fmadd_pd(_mm512_loadu_pd(sx+i+8), _mm512_loadu_pd(sy+i+8), s1);
+    s2 = _mm512_fmadd_pd(_mm512_loadu_pd(sx+i+16), _mm512_loadu_pd(sy+i+16), s2);
+    s3 = _mm512_fmadd_pd(_mm512_loadu_pd(sx+i+24), _mm512_loadu_pd(sy+i+24), s3);
+  }
+  for ( ; i+8 <= n; i += 8)
+    s0 = _mm512_fmadd_pd(_mm512_loadu_pd(sx+i), _mm512_loadu_pd(sy+i), s0);
+  if (i < n)
+  {
+    __mmask8 k = (__mmask8)((1u << (n-i)) - 1);
+    s1 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(k, sx+i), _mm512_maskz_loadu_pd(k, sy+i), s1);
+  }
+  s0 = _mm512_add_pd(_mm512_add_pd(s0, s1), _mm512_add_pd(s2, s3));
+  return _mm512_reduce_add_pd(s0);
+}
+
+__attribute__((target("avx2,fma")))
+static double ddot_avx2(long int n, double *sx, double *sy)
+{
+  long int i;
+  double stemp;
+  __m128d h;
+  __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+  __m256d s2 = _mm256_setzero_pd(), s3 = _mm256_setzero_pd();
+
+  for (i = 0; i+16 <= n; i += 16)
+  {
+    s0 = _mm256_fmadd_pd(_mm256_loadu_pd(sx+i), _mm256_loadu_pd(sy+i), s0);
+    s1 = _mm256_fmadd_pd(_mm256_loadu_pd(sx+i+4), _mm256_loadu_pd(sy+i+4), s1);
+    s2 = _mm256_fmadd_pd(_mm256_loadu_pd(sx+i+8), _mm256_loadu_pd(sy+i+8), s2);
+    s3 = _mm256_fmadd_pd(_mm256_loadu_pd(sx+i+12), _mm256_loadu_pd(sy+i+12), s3);
+  }
+  for ( ; i+4 <= n; i += 4)
+    s0 = _mm256_fmadd_pd(_mm256_loadu_pd(sx+i), _mm256_loadu_pd(sy+i), s0);
+  s0 = _mm256_add_pd(_mm256_add_pd(s0, s1), _mm256_add_pd(s2, s3));
+  h = _mm_add_pd(_mm256_castpd256_pd128(s0), _mm256_extractf128_pd(s0, 1));
+  stemp = _mm_cvtsd_f64(_mm_add_sd(h, _mm_unpackhi_pd(h, h)));
+  for ( ; i < n; i++)
+    stemp += sx[i] * sy[i];
+  return stemp;
+}
+#endif
+
 double ddot_(int *n, double *sx, int *incx, double *sy, int *incy)
 {
   long int i, m, nn, iincx, iincy;
@@ -21,6 +75,12 @@ double ddot_(int *n, double *sx, int *incx, double *sy, int *incy)
   {
     if (iincx == 1 && iincy == 1) /* code for both increments equal to 1 */
     {
+#ifdef BLAS_X86_SIMD
+      if (blas_simd_level() == BLAS_AVX512)
+        return ddot_avx512(nn, sx, sy);
+      if (blas_simd_level() == BLAS_AVX2)
+        return ddot_avx2(nn, sx, sy);
+#endif
       m = nn-4;
       for (i = 0; i < m; i += 5)
         stemp += sx[i] * sy[i] + sx[i+1] * sy[i+1] + sx[i+2] * sy[i+2] +
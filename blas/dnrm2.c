@@ -1,6 +1,88 @@
 #include <math.h>  /* Needed for fabs() and sqrt() */
 #include "blas.h"
 
+#ifdef BLAS_X86_SIMD
+/* One pass for both the sum of squares and the largest |x[i]|. If the
+   latter shows that the sum can neither overflow nor lose the large
+   elements to underflow, sqrt of the sum is the norm and 1 is returned;
+   otherwise (or on a NaN) 0 is, and the scaled loop has to be used. */
+#define DNRM2_SAFE(big) ((big) == 0.0 || ((big) > 0x1p-450 && (big) < 0x1p450))
+
+__attribute__((target("avx512f")))
+static int dnrm2_avx512(long int n, double *x, double *norm)
+{
+  long int i;
+  double big;
+  __m512d s0 = _mm512_setzero_pd(), s1 = _mm512_setzero_pd();
+  __m512d m0 = _mm512_setzero_pd(), m1 = _mm512_setzero_pd();
+
+  for (i = 0; i+16 <= n; i += 16)
+  {
+    __m512d x0 = _mm512_loadu_pd(x+i);
+    __m512d x1 = _mm512_loadu_pd(x+i+8);
+    s0 = _mm512_fmadd_pd(x0, x0, s0);
+    s1 = _mm512_fmadd_pd(x1, x1, s1);
+    m0 = _mm512_max_pd(m0, _mm512_abs_pd(x0));
+    m1 = _mm512_max_pd(m1, _mm512_abs_pd(x1));
+  }
+  if (i+8 <= n)
+  {
+    __m512d x0 = _mm512_loadu_pd(x+i);
+    s0 = _mm512_fmadd_pd(x0, x0, s0);
+    m0 = _mm512_max_pd(m0, _mm512_abs_pd(x0));
+    i += 8;
+  }
+  if (i < n)
+  {
+    __mmask8 k = (__mmask8)((1u << (n-i)) - 1);
+    __m512d x1 = _mm512_maskz_loadu_pd(k, x+i);
+    s1 = _mm512_fmadd_pd(x1, x1, s1);
+    m1 = _mm512_max_pd(m1, _mm512_abs_pd(x1));
+  }
+  big = _mm512_reduce_max_pd(_mm512_max_pd(m0, m1));
+  if (!DNRM2_SAFE(big))
+    return 0;
+  *norm = sqrt(_mm512_reduce_add_pd(_mm512_add_pd(s0, s1)));
+  return 1;
+}
+
+__attribute__((target("avx2,fma")))
+static int dnrm2_avx2(long int n, double *x, double *norm)
+{
+  long int i;
+  double big, ssq;
+  __m128d h;
+  __m256d sign = _mm256_set1_pd(-0.0);
+  __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+  __m256d m0 = _mm256_setzero_pd(), m1 = _mm256_setzero_pd();
+
+  for (i = 0; i+8 <= n; i += 8)
+  {
+    __m256d x0 = _mm256_loadu_pd(x+i);
+    __m256d x1 = _mm256_loadu_pd(x+i+4);
+    s0 = _mm256_fmadd_pd(x0, x0, s0);
+    s1 = _mm256_fmadd_pd(x1, x1, s1);
+    m0 = _mm256_max_pd(m0, _mm256_andnot_pd(sign, x0));
+    m1 = _mm256_max_pd(m1, _mm256_andnot_pd(sign, x1));
+  }
+  s0 = _mm256_add_pd(s0, s1);
+  m0 = _mm256_max_pd(m0, m1);
+  h = _mm_add_pd(_mm256_castpd256_pd128(s0), _mm256_extractf128_pd(s0, 1));
+  ssq = _mm_cvtsd_f64(_mm_add_sd(h, _mm_unpackhi_pd(h, h)));
+  h = _mm_max_pd(_mm256_castpd256_pd128(m0), _mm256_extractf128_pd(m0, 1));
+  big = _mm_cvtsd_f64(_mm_max_sd(h, _mm_unpackhi_pd(h, h)));
+  for ( ; i < n; i++)
+  {
+    ssq += x[i] * x[i];
+    big = MAX(big, fabs(x[i]));
+  }
+  if (!DNRM2_SAFE(big))
+    return 0;
+  *norm = sqrt(ssq);
+  return 1;
+}
+#endif
+
 double dnrm2_(int *n, double *x, int *incx)
 {
   long int ix, nn, iincx;
@@ -27,6 +109,12 @@ double dnrm2_(int *n, double *x, int *incx)
     }  
     else
     {
+#ifdef BLAS_X86_SIMD
+      if (iincx == 1 && blas_simd_level() == BLAS_AVX512 && dnrm2_avx512(nn, x, &norm))
+        return norm;
+      if (iincx == 1 && blas_simd_level() == BLAS_AVX2 && dnrm2_avx2(nn, x, &norm))
+        return norm;
+#endif
       scale = 0.0;
       ssq = 1.0;
 
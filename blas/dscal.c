@@ -1,5 +1,46 @@
 #include "blas.h"
 
+#ifdef BLAS_X86_SIMD
+__attribute__((target("avx512f")))
+static void dscal_avx512(long int n, double ssa, double *sx)
+{
+  long int i;
+  __m512d a = _mm512_set1_pd(ssa);
+
+  for (i = 0; i+16 <= n; i += 16)
+  {
+    __m512d x0 = _mm512_mul_pd(a, _mm512_loadu_pd(sx+i));
+    __m512d x1 = _mm512_mul_pd(a, _mm512_loadu_pd(sx+i+8));
+    _mm512_storeu_pd(sx+i, x0);
+    _mm512_storeu_pd(sx+i+8, x1);
+  }
+  for ( ; i+8 <= n; i += 8)
+    _mm512_storeu_pd(sx+i, _mm512_mul_pd(a, _mm512_loadu_pd(sx+i)));
+  if (i < n)
+  {
+    __mmask8 k = (__mmask8)((1u << (n-i)) - 1);
+    _mm512_mask_storeu_pd(sx+i, k, _mm512_mul_pd(a, _mm512_maskz_loadu_pd(k, sx+i)));
+  }
+}
+
+__attribute__((target("avx2")))
+static void dscal_avx2(long int n, double ssa, double *sx)
+{
+  long int i;
+  __m256d a = _mm256_set1_pd(ssa);
+
+  for (i = 0; i+8 <= n; i += 8)
+  {
+    __m256d x0 = _mm256_mul_pd(a, _mm256_loadu_pd(sx+i));
+    __m256d x1 = _mm256_mul_pd(a, _mm256_loadu_pd(sx+i+4));
+    _mm256_storeu_pd(sx+i, x0);
+    _mm256_storeu_pd(sx+i+4, x1);
+  }
+  for ( ; i < n; i++)
+    sx[i] = ssa * sx[i];
+}
+#endif
+
 int dscal_(int *n, double *sa, double *sx, int *incx)
 {
   long int i, m, nincx, nn, iincx;
@@ -20,6 +61,18 @@ int dscal_(int *n, double *sa, double *sx, int *incx)
   {
     if (iincx == 1) /* code for increment equal to 1 */
     {
+#ifdef BLAS_X86_SIMD
+      if (blas_simd_level() == BLAS_AVX512)
+      {
+        dscal_avx512(nn, ssa, sx);
+        return 0;
+      }
+      if (blas_simd_level() == BLAS_AVX2)
+      {
+        dscal_avx2(nn, ssa, sx);
+        return 0;
+      }
+#endif
       m = nn-4;
       for (i = 0; i < m; i += 5)
       {
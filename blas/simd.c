@@ -0,0 +1,23 @@
+#include "blas.h"
+
+/* Which kernels the CPU can run: BLAS_AVX512 needs AVX-512F, BLAS_AVX2
+   needs AVX2 and FMA. The answer is found on the first call; threads
+   racing on it store the same value. */
+int blas_simd_level(void)
+{
+  static int level = -1;
+
+  if (level < 0)
+  {
+#ifdef BLAS_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+      level = BLAS_AVX512;
+    else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+      level = BLAS_AVX2;
+    else
+#endif
+      level = BLAS_GENERIC;
+  }
+  return level;
+} /* blas_simd_level */
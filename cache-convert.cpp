@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "linear.h"
+#include "dataset.h"
+
+void exit_with_help()
+{
+	printf(
+	"Usage: cache-convert [options] data_file cache_file\n"
+	"Convert a libsvm data file into a binary cache which train, train-perf,\n"
+	"bagging and knn map directly instead of parsing, and which train -M\n"
+	"reads block by block. Memory use does not grow with the size of data_file.\n"
+	"options:\n"
+	"-B bias : if bias >= 0, instance x becomes [x; bias]; if < 0, no bias term added (default -1)\n"
+	"	the tools must be run with the same -B on the cache\n"
+	"-n nr_thread : number of threads used to parse data_file (default: all cores)\n"
+	);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int i;
+	double bias = -1;
+	int nr_thread = 0;
+
+	for(i=1;i<argc;i++)
+	{
+		if(argv[i][0] != '-') break;
+		if(++i>=argc)
+			exit_with_help();
+		switch(argv[i-1][1])
+		{
+			case 'B':
+				bias = atof(argv[i]);
+				break;
+
+			case 'n':
+				nr_thread = atoi(argv[i]);
+				break;
+
+			default:
+				fprintf(stderr,"unknown option: -%c\n", argv[i-1][1]);
+				exit_with_help();
+				break;
+		}
+	}
+	if(i+1 >= argc)
+		exit_with_help();
+
+	if(convert_problem_cache(argv[i], argv[i+1], bias, nr_thread))
+	{
+		fprintf(stderr,"can't save cache to file %s\n",argv[i+1]);
+		exit(1);
+	}
+
+	return 0;
+}
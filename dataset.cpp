@@ -0,0 +1,941 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <vector>
+#include <thread>
+#include "linear.h"
+#include "dataset.h"
+#include "parallel.h"
+
+#define Malloc(type,n) (type *)malloc((n)*sizeof(type))
+#ifndef min
+template <class T> static inline T min(T x,T y) { return (x<y)?x:y; }
+#endif
+#ifndef max
+template <class T> static inline T max(T x,T y) { return (x>y)?x:y; }
+#endif
+
+// inputs are cut into at most one chunk per thread and MIN_CHUNK_SIZE bytes
+#define MIN_CHUNK_SIZE (1<<20)
+// convert_problem_cache() parses about this many bytes at a time
+#define CONVERT_WINDOW ((size_t)64<<20)
+
+// On-disk layout of a binary cache, in native byte order:
+//   cache_header
+//   double y[l]
+//   int64_t row_start[l+1]		offset of each instance in x_space
+//   feature_node x_space[elements]	bias nodes and sentinels included
+// Every array starts at a multiple of 8 bytes, so a mapped cache can be
+// used in place.
+static const char cache_magic[8] = {'L','I','B','L','I','N','B','C'};
+#define CACHE_VERSION 1
+
+struct cache_header
+{
+	char magic[8];
+	int32_t version;
+	int32_t l, n;
+	int32_t reserved0;
+	double bias;
+	int64_t elements;
+	int64_t reserved[3];
+};
+
+// caches currently mapped by read_problem(), to be unmapped by free_problem()
+// of the problem whose labels are y
+struct cache_map
+{
+	void *addr;
+	size_t len;
+	const double *y;
+};
+static std::vector<cache_map> cache_maps;
+
+// powers of ten which are exact in double precision
+static const double exact_pow10[] =
+{
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline bool is_blank(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static inline bool is_digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+template <class T> static inline void reserve(T *&a, long &cap, long need)
+{
+	if(need <= cap)
+		return;
+	while(cap < need)
+		cap = (cap > 0)? 2*cap: 1024;
+	a = (T *) realloc(a, sizeof(T)*(size_t)cap);
+	if(a == NULL)
+	{
+		fprintf(stderr,"can't allocate memory for the data\n");
+		exit(1);
+	}
+}
+
+// strtod() on a token [p,end) which is not NUL-terminated
+static bool parse_double_slow(const char *p, const char *end, double *ret)
+{
+	char buf[64];
+	char *s = buf, *endptr;
+	size_t len = (size_t)(end-p);
+
+	if(len >= sizeof(buf))
+		s = Malloc(char,len+1);
+	memcpy(s, p, len);
+	s[len] = '\0';
+
+	errno = 0;
+	*ret = strtod(s, &endptr);
+	bool ok = (endptr != s && errno == 0 && *endptr == '\0');
+
+	if(s != buf)
+		free(s);
+	return ok;
+}
+
+// Parse the whole token [p,end) as a double. A decimal number with at
+// most 19 significant digits m and exponent |e| <= 22 is m*10^e with
+// m < 2^53 exact, so one multiplication or division gives the correctly
+// rounded value, i.e. the same bits as strtod. Everything else (long
+// mantissas, huge exponents, inf/nan, hex) is left to strtod.
+static bool parse_double(const char *p, const char *end, double *ret)
+{
+	const char *s = p;
+	bool neg = false;
+	unsigned long long m = 0;
+	int nd = 0, ndigit = 0, e = 0;
+
+	if(s < end && (*s == '-' || *s == '+'))
+		neg = (*s++ == '-');
+	for(; s < end && is_digit(*s); s++, ndigit++)
+	{
+		m = m*10 + (unsigned)(*s-'0');
+		if(m > 0 && ++nd > 19)
+			return parse_double_slow(p, end, ret);
+	}
+	if(s < end && *s == '.')
+	{
+		for(s++; s < end && is_digit(*s); s++, ndigit++, e--)
+		{
+			m = m*10 + (unsigned)(*s-'0');
+			if(m > 0 && ++nd > 19)
+				return parse_double_slow(p, end, ret);
+		}
+	}
+	if(ndigit == 0)
+		return parse_double_slow(p, end, ret);
+	if(s < end && (*s == 'e' || *s == 'E'))
+	{
+		bool eneg = false;
+		int x = 0;
+		const char *q;
+
+		s++;
+		if(s < end && (*s == '-' || *s == '+'))
+			eneg = (*s++ == '-');
+		for(q = s; s < end && is_digit(*s); s++)
+			if(x < 10000)
+				x = x*10 + (*s-'0');
+		if(s == q)
+			return parse_double_slow(p, end, ret);
+		e += eneg? -x: x;
+	}
+	if(s != end || m > (1ULL<<53) || e < -22 || e > 22)
+		return parse_double_slow(p, end, ret);
+
+	double v = (double)m;
+	if(e < 0)
+		v /= exact_pow10[-e];
+	else
+		v *= exact_pow10[e];
+	*ret = neg? -v: v;
+	return true;
+}
+
+// a positive decimal integer which fits in int, maybe with a '+' as
+// strtol() took it
+static bool parse_index(const char *p, const char *end, int *ret)
+{
+	long v = 0;
+
+	if(p < end && *p == '+')
+		p++;
+	if(p == end)
+		return false;
+	for(; p < end; p++)
+	{
+		if(!is_digit(*p))
+			return false;
+		v = v*10 + (*p-'0');
+		if(v > INT_MAX)
+			return false;
+	}
+	*ret = (int)v;
+	return true;
+}
+
+// instances parsed from a contiguous range of lines
+struct chunk
+{
+	int l;
+	double *y;
+	long *row_start;	// offset of each instance in x_space
+	feature_node *x_space;
+	long elements;		// #feature_node used, bias and sentinels included
+	int max_index;
+	int error_line;		// first bad line (1-based) or 0
+};
+
+// Single pass over [p,end): x_space, y and row_start grow geometrically
+// as lines are parsed. A bias node gets index 0 here; the caller sets it
+// once the global max_index is known.
+static void parse_chunk(const char *p, const char *end, double bias, chunk *c)
+{
+	long cap_y = 0, cap_r = 0, cap_x = 0;
+
+	c->l = 0;
+	c->y = NULL;
+	c->row_start = NULL;
+	c->x_space = NULL;
+	c->elements = 0;
+	c->max_index = 0;
+	c->error_line = 0;
+
+	while(p < end)
+	{
+		const char *eol = (const char *) memchr(p, '\n', (size_t)(end-p));
+		const char *q;
+		int inst_max_index = 0;
+
+		if(eol == NULL)
+			eol = end;
+
+		reserve(c->y, cap_y, c->l+1);
+		reserve(c->row_start, cap_r, c->l+1);
+		c->row_start[c->l] = c->elements;
+		c->l++;
+
+		// label
+		while(p < eol && is_blank(*p))
+			p++;
+		for(q = p; q < eol && !is_blank(*q); q++)
+			;
+		if(p == q || !parse_double(p, q, &c->y[c->l-1]))
+		{
+			c->error_line = c->l;
+			return;
+		}
+
+		// features
+		for(p = q; ; p = q)
+		{
+			while(p < eol && is_blank(*p))
+				p++;
+			if(p == eol)
+				break;
+
+			reserve(c->x_space, cap_x, c->elements+1);
+			feature_node *node = &c->x_space[c->elements];
+
+			for(q = p; q < eol && *q != ':' && !is_blank(*q); q++)
+				;
+			if(q == eol || *q != ':' || !parse_index(p, q, &node->index) ||
+			   node->index <= inst_max_index)
+			{
+				c->error_line = c->l;
+				return;
+			}
+			inst_max_index = node->index;
+
+			// blanks may follow the colon, as strtok() skipped them
+			for(p = q+1; p < eol && is_blank(*p); p++)
+				;
+			for(q = p; q < eol && !is_blank(*q); q++)
+				;
+			if(!parse_double(p, q, &node->value))
+			{
+				c->error_line = c->l;
+				return;
+			}
+			c->elements++;
+		}
+
+		if(inst_max_index > c->max_index)
+			c->max_index = inst_max_index;
+
+		reserve(c->x_space, cap_x, c->elements+2);
+		if(bias >= 0)
+		{
+			c->x_space[c->elements].index = 0;
+			c->x_space[c->elements].value = bias;
+			c->elements++;
+		}
+		c->x_space[c->elements].index = -1;
+		c->x_space[c->elements].value = 0;
+		c->elements++;
+
+		p = (eol < end)? eol+1: end;
+	}
+}
+
+// fallback for inputs which cannot be mapped, e.g. pipes
+static char *read_all(int fd, size_t *len_ret)
+{
+	long cap = 0, len = 0;
+	char *buf = NULL;
+
+	while(1)
+	{
+		reserve(buf, cap, len+65536);
+		ssize_t r = read(fd, buf+len, (size_t)(cap-len));
+		if(r <= 0)
+			break;
+		len += (long)r;
+	}
+	*len_ret = (size_t)len;
+	return buf;
+}
+
+// Cut [buf,buf+len) into nr_chunk pieces of about equal size which end
+// at line boundaries; piece k is [bound[k],bound[k+1]).
+static void split_lines(const char *buf, size_t len, int nr_chunk, std::vector<const char *> &bound)
+{
+	bound.resize((size_t)nr_chunk+1);
+	bound[0] = buf;
+	bound[(size_t)nr_chunk] = buf+len;
+	for(int k=1;k<nr_chunk;k++)
+	{
+		const char *p = max(bound[(size_t)k-1], buf + len/(size_t)nr_chunk*(size_t)k);
+		const char *eol = (const char *) memchr(p, '\n', (size_t)(buf+len-p));
+		bound[(size_t)k] = (eol == NULL)? buf+len: eol+1;
+	}
+}
+
+// Parse [buf,buf+len) into chunks cut at line boundaries, one per
+// thread; small inputs are not worth a thread.
+static void parse_parallel(const char *buf, size_t len, double bias, int nr_thread, std::vector<chunk> &c)
+{
+	nr_thread = get_nr_thread(nr_thread);
+	int nr_chunk = (int)min((size_t)nr_thread, len/MIN_CHUNK_SIZE);
+	if(nr_chunk < 1)
+		nr_chunk = 1;
+
+	std::vector<const char *> bound;
+	split_lines(buf, len, nr_chunk, bound);
+
+	c.resize((size_t)nr_chunk);
+	run_parallel(nr_chunk, [&](int k) {
+		parse_chunk(bound[k], bound[k+1], bias, &c[(size_t)k]);
+	});
+}
+
+// Read the header of a cache of len bytes and check it against the file
+// size and the requested bias.
+static void read_cache_header(const char *filename, int fd, size_t len, double bias, cache_header *hdr)
+{
+	// read_problem() only comes here for a file that starts as a cache,
+	// so one that does not was given to train_blocks() unconverted
+	if(pread(fd, hdr, sizeof(*hdr), 0) != (ssize_t)sizeof(*hdr) ||
+	   memcmp(hdr->magic, cache_magic, sizeof(cache_magic)) != 0)
+	{
+		fprintf(stderr,"%s is not a cache file; -M needs one made by cache-convert\n",filename);
+		exit(1);
+	}
+	if(hdr->version != CACHE_VERSION ||
+	   hdr->l < 0 || hdr->elements < 0 ||
+	   len != sizeof(*hdr) + sizeof(double)*(size_t)hdr->l +
+	          sizeof(int64_t)*((size_t)hdr->l+1) + sizeof(feature_node)*(size_t)hdr->elements)
+	{
+		fprintf(stderr,"corrupted cache file %s\n",filename);
+		exit(1);
+	}
+	if((hdr->bias >= 0) != (bias >= 0) || (bias >= 0 && hdr->bias != bias))
+	{
+		fprintf(stderr,"cache file %s was built with bias %g; convert it again with -B %g\n",filename,hdr->bias,bias);
+		exit(1);
+	}
+}
+
+// Check the row offsets of a cache read with hdr: they must start at 0,
+// give every instance at least its sentinel and end at hdr->elements.
+// If x_space is not NULL, every row of it must also end with its
+// sentinel. A corrupt cache would else have rows point outside the data.
+static void check_cache_rows(const char *filename, const cache_header *hdr, const int64_t *row_start, const feature_node *x_space)
+{
+	int i;
+	bool ok = row_start[0] == 0 && row_start[hdr->l] == hdr->elements;
+	for(i=0;ok && i<hdr->l;i++)
+		ok = row_start[i] < row_start[i+1];
+	// only now is every row known to lie within x_space
+	for(i=0;ok && x_space != NULL && i<hdr->l;i++)
+		ok = x_space[row_start[i+1]-1].index == -1;
+	if(!ok)
+	{
+		fprintf(stderr,"corrupted cache file %s\n",filename);
+		exit(1);
+	}
+}
+
+// Map a binary cache and point prob->y and prob->x into it; nothing is
+// parsed or copied, and processes mapping the same cache share its pages.
+static struct feature_node *load_cache(const char *filename, int fd, size_t len, double bias, struct problem *prob)
+{
+	cache_header hdr;
+	int i;
+
+	read_cache_header(filename, fd, len, bias, &hdr);
+
+	// private and writable so that a solver touching the data gets its own
+	// copy of the page instead of a fault
+	void *addr = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(addr == MAP_FAILED)
+	{
+		fprintf(stderr,"can't map cache file %s\n",filename);
+		exit(1);
+	}
+
+	char *base = (char *)addr + sizeof(hdr);
+	double *y = (double *)base;
+	int64_t *row_start = (int64_t *)(base + sizeof(double)*(size_t)hdr.l);
+	feature_node *x_space = (feature_node *)(row_start + hdr.l+1);
+	check_cache_rows(filename, &hdr, row_start, x_space);
+
+	cache_map map = {addr, len, y};
+	cache_maps.push_back(map);
+
+	prob->l = hdr.l;
+	prob->n = hdr.n;
+	prob->bias = hdr.bias;
+	prob->y = y;
+	prob->x = Malloc(struct feature_node *,prob->l);
+	for(i=0;i<prob->l;i++)
+		prob->x[i] = &x_space[row_start[i]];
+	return x_space;
+}
+
+int save_problem_cache(const char *filename, const struct problem *prob)
+{
+	int i;
+	int64_t elements = 0;
+	cache_header hdr;
+	FILE *fp = fopen(filename,"wb");
+	if(fp == NULL)
+		return -1;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, cache_magic, sizeof(cache_magic));
+	hdr.version = CACHE_VERSION;
+	hdr.l = prob->l;
+	hdr.n = prob->n;
+	hdr.bias = prob->bias;
+	for(i=0;i<prob->l;i++)
+	{
+		const feature_node *x = prob->x[i];
+		while(x->index != -1)
+			x++;
+		elements += x - prob->x[i] + 1;
+	}
+	hdr.elements = elements;
+
+	fwrite(&hdr, sizeof(hdr), 1, fp);
+	fwrite(prob->y, sizeof(double), (size_t)prob->l, fp);
+
+	// rows need not be contiguous in memory; they are in the cache
+	int64_t start = 0;
+	for(i=0;i<prob->l;i++)
+	{
+		const feature_node *x = prob->x[i];
+		fwrite(&start, sizeof(start), 1, fp);
+		while(x->index != -1)
+			x++;
+		start += x - prob->x[i] + 1;
+	}
+	fwrite(&start, sizeof(start), 1, fp);
+	for(i=0;i<prob->l;i++)
+	{
+		const feature_node *x = prob->x[i];
+		while(x->index != -1)
+			x++;
+		fwrite(prob->x[i], sizeof(feature_node), (size_t)(x - prob->x[i] + 1), fp);
+	}
+
+	if (ferror(fp) != 0 || fclose(fp) != 0) return -1;
+	else return 0;
+}
+
+// read or write exactly len bytes at offset
+static bool read_at(int fd, void *buf, size_t len, off_t offset)
+{
+	char *p = (char *)buf;
+	while(len > 0)
+	{
+		ssize_t r = pread(fd, p, len, offset);
+		if(r <= 0)
+			return false;
+		p += r;
+		len -= (size_t)r;
+		offset += r;
+	}
+	return true;
+}
+
+static bool write_at(int fd, const void *buf, size_t len, off_t offset)
+{
+	const char *p = (const char *)buf;
+	while(len > 0)
+	{
+		ssize_t r = pwrite(fd, p, len, offset);
+		if(r <= 0)
+			return false;
+		p += r;
+		len -= (size_t)r;
+		offset += r;
+	}
+	return true;
+}
+
+// Count the instances of [p,end) the way parse_chunk() does, and find the
+// largest index, which is that of the last feature of some line as
+// indices ascend. Malformed lines are left for parse_chunk() to report.
+static void scan_lines(const char *p, const char *end, long *l, int *max_index)
+{
+	*l = 0;
+	*max_index = 0;
+	while(p < end)
+	{
+		const char *eol = (const char *) memchr(p, '\n', (size_t)(end-p));
+		if(eol == NULL)
+			eol = end;
+		(*l)++;
+
+		const char *q = (const char *) memrchr(p, ':', (size_t)(eol-p));
+		if(q != NULL)
+		{
+			const char *r = q;
+			int index;
+			while(r > p && is_digit(r[-1]))
+				r--;
+			if(parse_index(r, q, &index) && index > *max_index)
+				*max_index = index;
+		}
+		p = (eol < end)? eol+1: end;
+	}
+}
+
+// Give the pages of a processed window back; a mapped input would
+// otherwise stay resident until the whole file is done.
+static void drop_pages(const char *buf, size_t from, size_t to)
+{
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	from -= from%page;
+	to -= to%page;
+	if(to > from)
+		madvise((void *)(buf+from), to-from, MADV_DONTNEED);
+}
+
+// end of the window of about CONVERT_WINDOW bytes starting at off
+static size_t window_end(const char *buf, size_t len, size_t off)
+{
+	if(len-off <= CONVERT_WINDOW)
+		return len;
+	const char *eol = (const char *) memchr(buf+off+CONVERT_WINDOW, '\n', len-off-CONVERT_WINDOW);
+	return (eol == NULL)? len: (size_t)(eol-buf)+1;
+}
+
+int convert_problem_cache(const char *filename, const char *cache_filename, double bias, int nr_thread)
+{
+	int fd = open(filename, O_RDONLY);
+	struct stat st;
+	void *addr = MAP_FAILED;
+	size_t len = 0, off, end;
+	int k;
+
+	if(fd < 0)
+	{
+		fprintf(stderr,"can't open input file %s\n",filename);
+		exit(1);
+	}
+	if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+	{
+		len = (size_t)st.st_size;
+		addr = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	if(addr == MAP_FAILED)
+	{
+		// pipes and empty files are read as a whole
+		struct problem prob;
+		struct feature_node *x_space = read_problem(filename, bias, nr_thread, &prob);
+		int ret = save_problem_cache(cache_filename, &prob);
+		free_problem(&prob, x_space);
+		return ret;
+	}
+	madvise(addr, len, MADV_SEQUENTIAL);
+	const char *buf = (const char *)addr;
+	nr_thread = get_nr_thread(nr_thread);
+
+	// The first pass only finds l and n, which fix the layout of the
+	// cache; the second parses a window at a time and writes every
+	// instance to its final place.
+	long total_l = 0;
+	int max_index = 0;
+	for(off = 0; off < len; off = end)
+	{
+		end = window_end(buf, len, off);
+		int nr_chunk = (int)max((size_t)1, min((size_t)nr_thread, (end-off)/MIN_CHUNK_SIZE));
+		std::vector<const char *> bound;
+		std::vector<long> l(nr_chunk);
+		std::vector<int> m(nr_chunk);
+		split_lines(buf+off, end-off, nr_chunk, bound);
+		run_parallel(nr_chunk, [&](int k) {
+			scan_lines(bound[k], bound[k+1], &l[k], &m[k]);
+		});
+		for(k=0;k<nr_chunk;k++)
+		{
+			total_l += l[k];
+			max_index = max(max_index, m[k]);
+		}
+		drop_pages(buf, off, end);
+	}
+	if(total_l > INT_MAX)
+	{
+		fprintf(stderr,"too many instances in %s\n",filename);
+		exit(1);
+	}
+
+	cache_header hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, cache_magic, sizeof(cache_magic));
+	hdr.version = CACHE_VERSION;
+	hdr.l = (int32_t)total_l;
+	hdr.n = (bias >= 0)? max_index+1: max_index;
+	hdr.bias = bias;
+
+	off_t y_offset = (off_t)sizeof(hdr);
+	off_t row_offset = y_offset + (off_t)(sizeof(double)*(size_t)hdr.l);
+	off_t x_offset = row_offset + (off_t)(sizeof(int64_t)*((size_t)hdr.l+1));
+
+	int out = open(cache_filename, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+	if(out < 0)
+	{
+		munmap(addr, len);
+		return -1;
+	}
+
+	bool ok = true;
+	int first = 0;
+	int64_t elements = 0;
+	for(off = 0; off < len && ok; off = end)
+	{
+		end = window_end(buf, len, off);
+		std::vector<chunk> c;
+		parse_parallel(buf+off, end-off, bias, nr_thread, c);
+
+		for(k=0;k<(int)c.size();k++)
+		{
+			chunk *ck = &c[(size_t)k];
+			if(ck->error_line)
+			{
+				fprintf(stderr,"Wrong input format at line %d\n", first+ck->error_line);
+				exit(1);
+			}
+
+			std::vector<int64_t> row_start((size_t)ck->l);
+			for(int i=0;i<ck->l;i++)
+			{
+				row_start[(size_t)i] = elements + ck->row_start[i];
+				if(bias >= 0)
+				{
+					long e = (i+1 < ck->l)? ck->row_start[i+1]: ck->elements;
+					ck->x_space[e-2].index = hdr.n;
+				}
+			}
+			ok = ok && write_at(out, ck->y, sizeof(double)*(size_t)ck->l, y_offset + (off_t)(sizeof(double)*(size_t)first));
+			ok = ok && write_at(out, row_start.data(), sizeof(int64_t)*(size_t)ck->l, row_offset + (off_t)(sizeof(int64_t)*(size_t)first));
+			ok = ok && write_at(out, ck->x_space, sizeof(feature_node)*(size_t)ck->elements, x_offset + (off_t)(sizeof(feature_node)*(size_t)elements));
+			first += ck->l;
+			elements += ck->elements;
+
+			free(ck->y);
+			free(ck->row_start);
+			free(ck->x_space);
+		}
+		drop_pages(buf, off, end);
+	}
+	munmap(addr, len);
+
+	hdr.elements = elements;
+	ok = ok && first == hdr.l;
+	ok = ok && write_at(out, &elements, sizeof(elements), row_offset + (off_t)(sizeof(int64_t)*(size_t)hdr.l));
+	ok = ok && write_at(out, &hdr, sizeof(hdr), 0);
+	if(close(out) != 0 || !ok)
+		return -1;
+	return 0;
+}
+
+// block_source over a cache file: the labels and row offsets are read
+// once, the instances of a block with pread() whenever it is loaded
+struct cache_blocks
+{
+	char *filename;
+	int fd;
+	int64_t *row_start;
+	off_t x_offset;
+};
+
+static void load_cache_block(const struct block_source *src, int b, struct problem *prob)
+{
+	cache_blocks *cb = (cache_blocks *)src->data;
+	int s = src->start[b], e = src->start[b+1];
+	int64_t first = cb->row_start[s];
+	size_t elements = (size_t)(cb->row_start[e] - first);
+
+	prob->l = e-s;
+	prob->n = src->n;
+	prob->bias = src->bias;
+	prob->y = src->y + s;
+	prob->x = Malloc(struct feature_node *,prob->l);
+	if(prob->l == 0)
+		return;
+
+	feature_node *x_space = Malloc(feature_node,elements);
+	if(x_space == NULL || prob->x == NULL)
+	{
+		fprintf(stderr,"can't allocate memory for a block of %s\n",cb->filename);
+		exit(1);
+	}
+	if(!read_at(cb->fd, x_space, sizeof(feature_node)*elements, cb->x_offset + (off_t)(sizeof(feature_node)*(size_t)first)))
+	{
+		fprintf(stderr,"can't read cache file %s\n",cb->filename);
+		exit(1);
+	}
+	for(int i=0;i<prob->l;i++)
+	{
+		prob->x[i] = &x_space[cb->row_start[s+i] - first];
+		if(x_space[cb->row_start[s+i+1] - first - 1].index != -1)
+		{
+			fprintf(stderr,"corrupted cache file %s\n",cb->filename);
+			exit(1);
+		}
+	}
+}
+
+static void free_cache_block(const struct block_source *src, struct problem *prob)
+{
+	// rows are stored in order, so the first one starts the block's nodes
+	if(prob->l > 0)
+		free(prob->x[0]);
+	free(prob->x);
+}
+
+void open_block_source(const char *filename, double bias, size_t block_size, struct block_source *src)
+{
+	int fd = open(filename, O_RDONLY);
+	struct stat st;
+	cache_header hdr;
+	int i;
+
+	if(fd < 0)
+	{
+		fprintf(stderr,"can't open input file %s\n",filename);
+		exit(1);
+	}
+	if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+	{
+		fprintf(stderr,"%s is not a cache file; run cache-convert on it first\n",filename);
+		exit(1);
+	}
+	read_cache_header(filename, fd, (size_t)st.st_size, bias, &hdr);
+
+	cache_blocks *cb = Malloc(cache_blocks,1);
+	cb->filename = strdup(filename);
+	cb->fd = fd;
+	cb->row_start = Malloc(int64_t,(size_t)hdr.l+1);
+	cb->x_offset = (off_t)(sizeof(hdr) + sizeof(double)*(size_t)hdr.l + sizeof(int64_t)*((size_t)hdr.l+1));
+
+	src->l = hdr.l;
+	src->n = hdr.n;
+	src->bias = hdr.bias;
+	src->y = Malloc(double,hdr.l);
+	if(!read_at(fd, src->y, sizeof(double)*(size_t)hdr.l, (off_t)sizeof(hdr)) ||
+	   !read_at(fd, cb->row_start, sizeof(int64_t)*((size_t)hdr.l+1), (off_t)(sizeof(hdr) + sizeof(double)*(size_t)hdr.l)))
+	{
+		fprintf(stderr,"can't read cache file %s\n",filename);
+		exit(1);
+	}
+	// the sentinels are checked as each block is read
+	check_cache_rows(filename, &hdr, cb->row_start, NULL);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	// a block ends before the instance which would take it over
+	// block_size bytes, counting the nodes and the row pointers
+	std::vector<int> start(1, 0);
+	for(i=0;i<hdr.l;i++)
+	{
+		int s = start.back();
+		size_t size = sizeof(feature_node)*(size_t)(cb->row_start[i+1] - cb->row_start[s]) +
+		              sizeof(feature_node *)*(size_t)(i+1-s);
+		if(size > block_size && i > s)
+			start.push_back(i);
+	}
+	start.push_back(hdr.l);
+
+	src->nr_block = (int)start.size()-1;
+	src->start = Malloc(int,start.size());
+	memcpy(src->start, start.data(), sizeof(int)*start.size());
+	src->load_block = &load_cache_block;
+	src->free_block = &free_cache_block;
+	src->data = cb;
+}
+
+void close_block_source(struct block_source *src)
+{
+	cache_blocks *cb = (cache_blocks *)src->data;
+	close(cb->fd);
+	free(cb->filename);
+	free(cb->row_start);
+	free(cb);
+	free(src->y);
+	free(src->start);
+}
+
+struct feature_node *read_problem(const char *filename, double bias, int nr_thread, struct problem *prob)
+{
+	int k;
+	int fd = open(filename, O_RDONLY);
+	struct stat st;
+	char *buf = NULL;
+	size_t len = 0;
+	bool mapped = false;
+
+	if(fd < 0)
+	{
+		fprintf(stderr,"can't open input file %s\n",filename);
+		exit(1);
+	}
+
+	if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+	{
+		char magic[sizeof(cache_magic)];
+		len = (size_t)st.st_size;
+		if(pread(fd, magic, sizeof(magic), 0) == (ssize_t)sizeof(magic) &&
+		   memcmp(magic, cache_magic, sizeof(magic)) == 0)
+			return load_cache(filename, fd, len, bias, prob);
+
+		void *addr = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(addr != MAP_FAILED)
+		{
+			madvise(addr, len, MADV_SEQUENTIAL);
+			buf = (char *)addr;
+			mapped = true;
+		}
+	}
+	if(!mapped)
+		buf = read_all(fd, &len);
+	close(fd);
+
+	std::vector<chunk> c;
+	parse_parallel(buf, len, bias, nr_thread, c);
+	int nr_chunk = (int)c.size();
+
+	if(mapped)
+		munmap(buf, len);
+	else
+		free(buf);
+
+	// line numbers of a chunk continue those of the previous chunks
+	std::vector<int> first(nr_chunk+1);
+	std::vector<long> offset(nr_chunk+1);
+	int max_index = 0;
+	first[0] = 0;
+	offset[0] = 0;
+	for(k=0;k<nr_chunk;k++)
+	{
+		if(c[k].error_line)
+		{
+			fprintf(stderr,"Wrong input format at line %d\n", first[k]+c[k].error_line);
+			exit(1);
+		}
+		first[k+1] = first[k] + c[k].l;
+		offset[k+1] = offset[k] + c[k].elements;
+		max_index = max(max_index, c[k].max_index);
+	}
+
+	prob->l = first[nr_chunk];
+	prob->bias = bias;
+	if(bias >= 0)
+		prob->n = max_index+1;
+	else
+		prob->n = max_index;
+
+	// Stitch the chunks in file order into the buffers of the first one;
+	// growing it also gives back the slack of the geometric growth.
+	feature_node *x_space = (feature_node *) realloc(c[0].x_space, sizeof(feature_node)*(size_t)offset[nr_chunk]);
+	if(x_space == NULL && offset[nr_chunk] > 0)
+	{
+		fprintf(stderr,"can't allocate memory for the data\n");
+		exit(1);
+	}
+	prob->y = (double *) realloc(c[0].y, sizeof(double)*(size_t)prob->l);
+	prob->x = Malloc(struct feature_node *,prob->l);
+
+	run_parallel(nr_chunk, [&](int k) {
+		feature_node *xk = &x_space[offset[k]];
+		if(k > 0 && c[k].l > 0)
+		{
+			memcpy(xk, c[k].x_space, sizeof(feature_node)*(size_t)c[k].elements);
+			memcpy(&prob->y[first[k]], c[k].y, sizeof(double)*(size_t)c[k].l);
+			free(c[k].x_space);
+			free(c[k].y);
+		}
+		for(int i=0;i<c[k].l;i++)
+		{
+			prob->x[first[k]+i] = &xk[c[k].row_start[i]];
+			// the bias node sits right before the sentinel
+			if(bias >= 0)
+			{
+				long end = (i+1 < c[k].l)? c[k].row_start[i+1]: c[k].elements;
+				xk[end-2].index = prob->n;
+			}
+		}
+		free(c[k].row_start);
+	});
+
+	return x_space;
+}
+
+void free_problem(struct problem *prob, struct feature_node *x_space)
+{
+	free(prob->x);
+	// matched by the labels: with no instances x_space may point just
+	// past the end of the map
+	for(size_t k=0;k<cache_maps.size();k++)
+	{
+		if(cache_maps[k].y == prob->y)
+		{
+			munmap(cache_maps[k].addr, cache_maps[k].len);
+			cache_maps.erase(cache_maps.begin()+(long)k);
+			return;
+		}
+	}
+	free(prob->y);
+	free(x_space);
+}
@@ -0,0 +1,49 @@
+#ifndef _DATASET_H
+#define _DATASET_H
+
+#include <stddef.h>
+#include "linear.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Read a data set in libsvm format, or a binary cache written by
+// save_problem_cache(), into prob. If bias >= 0, every
+// instance gets the extra feature (n, bias). The file is parsed by up to
+// nr_thread threads (all online cores if nr_thread <= 0); the result
+// does not depend on the thread count. The returned array is the
+// storage behind prob->x and must be released by free_problem().
+// On a missing file or a format error a message is printed and the
+// program exits, as the tools always did.
+//
+// A cache is mapped rather than read: prob->y and the rows of prob->x
+// point straight into the file's pages, so loading costs O(l) and
+// concurrent processes share one copy in the page cache. Its bias must
+// match the requested one.
+struct feature_node *read_problem(const char *filename, double bias, int nr_thread, struct problem *prob);
+void free_problem(struct problem *prob, struct feature_node *x_space);
+
+// Write prob as a binary cache; returns 0 on success, -1 on error.
+int save_problem_cache(const char *filename, const struct problem *prob);
+
+// Convert a data set in libsvm format into a binary cache without holding
+// it in memory: a regular file is parsed a window at a time and each
+// instance is written to its place in the cache, so memory use does not
+// depend on the size of the data. Other inputs go through read_problem().
+// Format errors are handled as in read_problem(); returns 0 on success,
+// -1 if the cache can't be written.
+int convert_problem_cache(const char *filename, const char *cache_filename, double bias, int nr_thread);
+
+// Set src up to read a binary cache for train_blocks() in blocks of at
+// most block_size bytes (or a single instance). Only the labels and the
+// row offsets are read now; a block is read with pread() when the
+// solver asks for it. Errors are handled as in read_problem().
+void open_block_source(const char *filename, double bias, size_t block_size, struct block_source *src);
+void close_block_source(struct block_source *src);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _DATASET_H */
@@ -4,6 +4,7 @@
 #include <algorithm>
 #include "linear.h"
 #include "eval.h"
+#include "rng.h"
 
 #define Malloc(type,n) (type *)malloc((n)*sizeof(type))
 
@@ -235,23 +236,45 @@ double auc(const dvec_t& dec_values, const dvec_t& ty){
 
 double binary_class_cross_validation(const problem *prob, const parameter *param, int nr_fold)
 {
-	int i;
+	double cv;
+	binary_class_cross_validation_path(prob, param, nr_fold, 1, &param->C, &cv);
+	return cv;
+}
+
+void binary_class_cross_validation_path(const problem *prob, const parameter *param, int nr_fold, int nr_C, const double *C, double *cv)
+{
+	int i,c;
 	int *fold_start = Malloc(int,nr_fold+1);
 	int l = prob->l;
 	int *perm = Malloc(int,l);
 	int * labels;
-	dvec_t dec_values;
+	std::vector<dvec_t> dec_values(nr_C);
 	dvec_t ty;
 
+	rng gen;
+	gen.seed((uint64_t)param->seed);
 	for(i=0;i<l;i++) perm[i]=i;
 	for(i=0;i<l;i++)
 	{
-		int j = i+rand()%(l-i);
+		int j = i+gen.uniform(l-i);
 		std::swap(perm[i],perm[j]);
 	}
 	for(i=0;i<=nr_fold;i++)
 		fold_start[i]=i*l/nr_fold;
 
+	// the instances in the order of perm, so that each fold is a range of
+	// rows to score in one call
+	struct problem perm_prob = *prob;
+	perm_prob.x = Malloc(struct feature_node*,l);
+	for(i=0;i<l;i++)
+		perm_prob.x[i] = prob->x[perm[i]];
+
+	// the folds share one workspace; init_alpha has no rows for them
+	struct parameter fold_param = *param;
+	if(fold_param.workspace == NULL)
+		fold_param.workspace = create_workspace();
+	fold_param.init_alpha = NULL;
+
 	for(i=0;i<nr_fold;i++)
 	{
 		int                begin   = fold_start[i];
@@ -278,23 +301,36 @@ double binary_class_cross_validation(const problem *prob, const parameter *param
 			subprob.y[k] = prob->y[perm[j]];
 			++k;
 		}
-		struct model *submodel = train(&subprob,param);
+		struct model **submodels = train_path(&subprob,&fold_param,nr_C,C);
+		if(submodels == NULL)
+		{
+			fprintf(stderr,"Error: the values of C must be increasing and positive\n");
+			exit(-1);
+		}
 
-		labels = Malloc(int, get_nr_class(submodel));
-		get_labels(submodel, labels);
+		labels = Malloc(int, get_nr_class(submodels[0]));
+		get_labels(submodels[0], labels);
 
-		if(get_nr_class(submodel) > 2) 
+		if(get_nr_class(submodels[0]) > 2) 
 		{
 			fprintf(stderr,"Error: the number of class is not equal to 2\n");
 			exit(-1);
 		}
 
-		dec_values.resize(end);
 		ty.resize(end);
-
-		for(j=begin; j<end; ++j) {
-			predict_values(submodel, prob->x[perm[j]], &dec_values[j]);
+		for(j=begin; j<end; ++j)
 			ty[j] = ((int)prob->y[perm[j]]==labels[0])?(+1):(-1);
+
+		// Crammer and Singer gives a value per class; the first one is used
+		dvec_t fold_values((size_t)(end-begin)*2);
+		for(c=0;c<nr_C;c++)
+		{
+			int nr_w = get_nr_decision_values(submodels[c]);
+			dec_values[c].resize(end);
+			predict_values_batch(submodels[c], &perm_prob, begin, end, fold_values.data(), NULL, param->nr_thread);
+			for(j=begin; j<end; ++j)
+				dec_values[c][j] = fold_values[(size_t)(j-begin)*nr_w];
+			free_and_destroy_model(&submodels[c]);
 		}
 
 //		if(labels[0] <= 0) {
@@ -302,16 +338,20 @@ double binary_class_cross_validation(const problem *prob, const parameter *param
 //				dec_values[j] *= -1;
 //		}
 	
-		free_and_destroy_model(&submodel);
+		free(submodels);
 		free(subprob.x);
 		free(subprob.y);
 		free(labels);
 	}		
 
+	if(fold_param.workspace != param->workspace)
+		destroy_workspace(fold_param.workspace);
+	free(perm_prob.x);
 	free(perm);
 	free(fold_start);
 
-	return validation_function(dec_values, ty);	
+	for(c=0;c<nr_C;c++)
+		cv[c] = validation_function(dec_values[c], ty);
 }
 
 
@@ -384,15 +424,30 @@ double regression_cross_validation(const problem * prob, const parameter * param
 	dvec_t pred_values;  //predicted
 	dvec_t true_values; //actual
 
+	rng gen;
+	gen.seed((uint64_t)param->seed);
 	for(i=0;i<l;i++) perm[i]=i;
 	for(i=0;i<l;i++)
 	{
-		int j = i + rand()%(l-i);
+		int j = i + gen.uniform(l-i);
 		std::swap(perm[i],perm[j]);
 	}
 	for(i=0;i<=nr_fold;i++)
 		fold_start[i] = i*l/nr_fold;
 
+	// the instances in the order of perm, so that each fold is a range of
+	// rows to score in one call
+	struct problem perm_prob = *prob;
+	perm_prob.x = Malloc(struct feature_node*,l);
+	for(i=0;i<l;i++)
+		perm_prob.x[i] = prob->x[perm[i]];
+
+	// the folds share one workspace; init_alpha has no rows for them
+	struct parameter fold_param = *param;
+	if(fold_param.workspace == NULL)
+		fold_param.workspace = create_workspace();
+	fold_param.init_alpha = NULL;
+
 	for(i=0;i<nr_fold;i++)
 	{
 		int                begin   = fold_start[i];
@@ -419,21 +474,23 @@ double regression_cross_validation(const problem * prob, const parameter * param
 			subprob.y[k] = prob->y[perm[j]];
 			++k;
 		}
-		struct model *submodel = train(&subprob,param);
+		struct model *submodel = train(&subprob,&fold_param);
 
 		pred_values.resize(end);
 		true_values.resize(end);
 
-		for(j=begin;j<end;j++) {
-			predict_values(submodel, prob->x[perm[j]], &pred_values[j]);
+		predict_values_batch(submodel, &perm_prob, begin, end, pred_values.data()+begin, NULL, param->nr_thread);
+		for(j=begin;j<end;j++)
 			true_values[j] = prob->y[perm[j]];
-		}
 	
 		free_and_destroy_model(&submodel);
 		free(subprob.x);
 		free(subprob.y);
 	}
 
+	if(fold_param.workspace != param->workspace)
+		destroy_workspace(fold_param.workspace);
+	free(perm_prob.x);
 	free(perm);
 	free(fold_start);
 
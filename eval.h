@@ -32,6 +32,9 @@ double r_squared(const dvec_t & pred_values, const dvec_t & true_values);
 
 /* cross validation function */
 double binary_class_cross_validation(const problem * prob, const parameter * param, int nr_fold);
+/* binary_class_cross_validation() at each of C[0] < ... < C[nr_C-1] into cv,
+   training each fold along the path of C */
+void binary_class_cross_validation_path(const problem * prob, const parameter * param, int nr_fold, int nr_C, const double * C, double * cv);
 double regression_cross_validation(const problem * prob, const parameter * param, int nr_fold);
 
 #endif
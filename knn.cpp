@@ -4,7 +4,9 @@
 #include <cstring>
 #include <iostream>
 #include "linear.h"
+#include "dataset.h"
 #include "common.h"
+#include "rng.h"
 
 using namespace std;
 
@@ -51,7 +53,6 @@ static char* readline(FILE *input)
 }
 
 void parse_command_line(int argc, char **argv, char *input_file_name, char *model_file_name);
-void read_problem(const char *filename);
 
 struct feature_node *x_space;
 struct parameter param;
@@ -59,7 +60,6 @@ struct problem prob;
 int flag_cross_validation;
 int nr_fold;
 double bias;
-long nnz;
 
 
 int main(int argc, char *argv[])
@@ -69,7 +69,7 @@ int main(int argc, char *argv[])
 	const char *error_msg;
 
 	parse_command_line(argc, argv, input_file_name, model_file_name);
-	read_problem(input_file_name);
+	x_space = read_problem(input_file_name, bias, 0, &prob);
 	error_msg = check_parameter(&prob,&param);
 
 	if(error_msg)
@@ -98,10 +98,12 @@ int main(int argc, char *argv[])
         int l = prob.l;
         int * perm = new int[l];
 
+        rng gen;
+        gen.seed((uint64_t)param.seed);
         for(i=0;i<l;i++) perm[i]=i;
         for(i=0;i<l;i++)
         {
-            int j = i+rand()%(l-i);
+            int j = i+gen.uniform(l-i);
             swap(perm[i],perm[j]);
         }
         for(i=0;i<=nr_fold;i++)
@@ -191,8 +193,10 @@ int main(int argc, char *argv[])
     //XXX predict
     int total = 0;
     int correct = 0;
-    int max_nr_attr = (int)nnz/prob.l;
+    int max_nr_attr = 64;
     feature_node * x = Malloc(feature_node, max_nr_attr);
+	max_line_len = 1024;
+	line = Malloc(char,max_line_len);
 	while(readline(test_input) != NULL)
 	{
 		int i = 0;
@@ -251,9 +255,7 @@ int main(int argc, char *argv[])
     fclose(test_input);
 
 	destroy_param(&param);
-	free(prob.y);
-	free(prob.x);
-	free(x_space);
+	free_problem(&prob, x_space);
 	free(line);
 	free(x);
 
@@ -274,6 +276,15 @@ void parse_command_line(int argc, char **argv, char *input_file_name, char *mode
 	param.nr_weight = 0;
 	param.weight_label = NULL;
 	param.weight = NULL;
+	param.nr_thread = 1;
+	param.by_column = 0;
+	param.precondition = 0;
+	param.hessian_sample = 1;
+	param.seed = 0;
+	param.shuffle_block = 0;
+	param.workspace = NULL;
+	param.init_sol = NULL;
+	param.init_alpha = NULL;
 	flag_cross_validation = 1;
     nr_fold = 5;
 	bias = -1;
@@ -384,108 +395,3 @@ void parse_command_line(int argc, char **argv, char *input_file_name, char *mode
 		}
 	}
 }
-
-// read in a problem (in libsvm format)
-void read_problem(const char *filename)
-{
-	int max_index, inst_max_index, i;
-	long int elements, j;
-	FILE *fp = fopen(filename,"r");
-	char *endptr;
-	char *idx, *val, *label;
-
-	if(fp == NULL)
-	{
-		fprintf(stderr,"can't open input file %s\n",filename);
-		exit(1);
-	}
-
-	prob.l = 0;
-	elements = 0;
-	max_line_len = 1024;
-	line = Malloc(char,max_line_len);
-	while(readline(fp)!=NULL)
-	{
-		char *p = strtok(line," \t"); // label
-
-		// features
-		while(1)
-		{
-			p = strtok(NULL," \t");
-			if(p == NULL || *p == '\n') // check '\n' as ' ' may be after the last feature
-				break;
-			elements++;
-		}
-		elements++; // for bias term
-		prob.l++;
-	}
-	rewind(fp);
-
-	prob.bias=bias;
-
-	prob.y = Malloc(double,prob.l);
-	prob.x = Malloc(struct feature_node *,prob.l);
-	x_space = Malloc(struct feature_node,elements+prob.l);
-
-    //XXX
-    nnz = elements+prob.l;
-
-	max_index = 0;
-	j=0;
-	for(i=0;i<prob.l;i++)
-	{
-		inst_max_index = 0; // strtol gives 0 if wrong format
-		readline(fp);
-		prob.x[i] = &x_space[j];
-		label = strtok(line," \t\n");
-		if(label == NULL) // empty line
-			exit_input_error(i+1);
-
-		prob.y[i] = strtod(label,&endptr);
-		if(endptr == label || *endptr != '\0')
-			exit_input_error(i+1);
-
-		while(1)
-		{
-			idx = strtok(NULL,":");
-			val = strtok(NULL," \t");
-
-			if(val == NULL)
-				break;
-
-			errno = 0;
-			x_space[j].index = (int) strtol(idx,&endptr,10);
-			if(endptr == idx || errno != 0 || *endptr != '\0' || x_space[j].index <= inst_max_index)
-				exit_input_error(i+1);
-			else
-				inst_max_index = x_space[j].index;
-
-			errno = 0;
-			x_space[j].value = strtod(val,&endptr);
-			if(endptr == val || errno != 0 || (*endptr != '\0' && !isspace(*endptr)))
-				exit_input_error(i+1);
-
-			++j;
-		}
-
-		if(inst_max_index > max_index)
-			max_index = inst_max_index;
-
-		if(prob.bias >= 0)
-			x_space[j++].value = prob.bias;
-
-		x_space[j++].index = -1;
-	}
-
-	if(prob.bias >= 0)
-	{
-		prob.n=max_index+1;
-		for(i=1;i<prob.l;i++)
-			(prob.x[i]-2)->index = prob.n;
-		x_space[j-2].index = prob.n;
-	}
-	else
-		prob.n=max_index;
-
-	fclose(fp);
-}
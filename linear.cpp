@@ -4,8 +4,13 @@
 #include <string.h>
 #include <stdarg.h>
 #include <locale.h>
+#include <thread>
+#include <vector>
+#include <new>
 #include "linear.h"
 #include "tron.h"
+#include "rng.h"
+#include "parallel.h"
 typedef signed char schar;
 template <class T> static inline void swap(T& x, T& y) { T t=x; x=y; y=t; }
 #ifndef min
@@ -22,6 +27,186 @@ template <class S, class T> static inline void clone(T*& dst, S* src, int n)
 #define Malloc(type,n) (type *)malloc((n)*sizeof(type))
 #define INF HUGE_VAL
 
+// The solvers are templates over the storage of the instances. A row
+// type walks the nonzeros of one instance,
+//
+//	for(auto x = row(prob, i); x.valid(); x.next())
+//		... x.index() ... x.value() ...
+//
+// with 1-based indices as in feature_node, and row(prob, i) is
+// overloaded for each kind of problem.
+
+// a feature_node array ended by index -1
+struct node_row
+{
+	const feature_node *x;
+
+	node_row(const feature_node *x): x(x) {}
+	bool valid() const { return x->index != -1; }
+	void next() { x++; }
+	int index() const { return x->index; }
+	double value() const { return x->value; }
+};
+
+// the indices of an instance whose values are all 1, ended by -1
+struct index_row
+{
+	const int *idx;
+
+	index_row(const int *idx): idx(idx) {}
+	bool valid() const { return *idx != -1; }
+	void next() { idx++; }
+	int index() const { return *idx; }
+	double value() const { return 1; }
+};
+
+// The value type of binary features, whose values are all 1 and are not
+// stored: a row is its indices alone, and as value() is a constant the
+// compiler drops the multiplies from every loop over it.
+struct unit {};
+
+// Steps through the values of a row kept apart from its indices. Values
+// may be stored as float, but get() widens them so that every product and
+// sum is still taken in double.
+template <class V> struct value_cursor
+{
+	const V *val;
+
+	value_cursor(const V *val): val(val) {}
+	void next() { val++; }
+	double get() const { return *val; }
+};
+
+template <> struct value_cursor<unit>
+{
+	value_cursor(const unit *val) {}
+	void next() {}
+	double get() const { return 1; }
+};
+
+// &val[k] for the values of a row starting at nonzero k
+template <class V> static inline const V *values_at(const V *val, long k) { return val+k; }
+static inline const unit *values_at(const unit *val, long k) { return NULL; }
+
+// a slice of the parallel arrays of a CSR matrix; its length is known
+// up front, so loops over it need no sentinel test
+template <class V> struct csr_row
+{
+	const int *idx, *end;
+	value_cursor<V> val;
+
+	csr_row(const int *idx, const int *end, const V *val): idx(idx), end(end), val(val) {}
+	bool valid() const { return idx != end; }
+	void next() { idx++; val.next(); }
+	int index() const { return *idx; }
+	double value() const { return val.get(); }
+};
+
+// A row whose indices are packed as the gaps between them, the first
+// taken from 0, each a varint: 7 bits per byte, low bits first, with the
+// top bit set on all but the last byte. Most gaps fit in one byte, so the
+// indices take about a quarter of the memory of an int array, and they
+// are decoded as the row is walked.
+template <class V> struct packed_row
+{
+	const unsigned char *p;
+	long left;
+	int idx;
+	value_cursor<V> val;
+
+	packed_row(const unsigned char *p, long nnz, const V *val): p(p), left(nnz), idx(0), val(val)
+	{
+		if(left > 0)
+			decode();
+	}
+	bool valid() const { return left > 0; }
+	void next()
+	{
+		val.next();
+		if(--left > 0)
+			decode();
+	}
+	int index() const { return idx; }
+	double value() const { return val.get(); }
+
+	void decode()
+	{
+		unsigned int gap = *p++;
+		if(gap & 0x80)
+		{
+			unsigned int b;
+			int shift = 7;
+			gap &= 0x7f;
+			do
+			{
+				b = *p++;
+				gap |= (b & 0x7f) << shift;
+				shift += 7;
+			} while(b & 0x80);
+		}
+		idx += (int)gap;
+	}
+};
+
+// Instances stored in CSR arrays as the solvers see them: instance i is
+// row perm[i] of the arrays, or row i if perm is NULL. Like problem, a
+// view carries the labels it is trained on.
+template <class V> struct csr_view
+{
+	int l, n;
+	double *y;
+	double bias;
+	const long *row_ptr;
+	const int *col_idx;
+	const V *val;
+	const int *perm;
+};
+
+// The same with the indices of row k packed as in packed_row in
+// idx_bytes[byte_ptr[k]], ..., idx_bytes[byte_ptr[k+1]-1]; its values
+// still start at val[row_ptr[k]].
+template <class V> struct packed_view
+{
+	int l, n;
+	double *y;
+	double bias;
+	const long *row_ptr;
+	const long *byte_ptr;
+	const unsigned char *idx_bytes;
+	const V *val;
+	const int *perm;
+};
+
+// the type in which a kind of problem stores its values
+template <class P> struct value_of { typedef double type; };
+template <class V> struct value_of<csr_view<V> > { typedef V type; };
+template <class V> struct value_of<packed_view<V> > { typedef V type; };
+
+static inline node_row row(const problem *prob, int i)
+{
+	return node_row(prob->x[i]);
+}
+
+template <class V> static inline csr_row<V> row(const csr_view<V> *prob, int i)
+{
+	int k = (prob->perm != NULL)? prob->perm[i]: i;
+	long begin = prob->row_ptr[k], end = prob->row_ptr[k+1];
+	return csr_row<V>(&prob->col_idx[begin], &prob->col_idx[end], values_at(prob->val, begin));
+}
+
+template <class V> static inline packed_row<V> row(const packed_view<V> *prob, int i)
+{
+	int k = (prob->perm != NULL)? prob->perm[i]: i;
+	long begin = prob->row_ptr[k];
+	return packed_row<V>(&prob->idx_bytes[prob->byte_ptr[k]], prob->row_ptr[k+1]-begin, values_at(prob->val, begin));
+}
+
+// storage for nnz values of type V, of which binary features need none
+template <class V> static V *new_values(long nnz) { return new V[nnz]; }
+template <> unit *new_values<unit>(long nnz) { return NULL; }
+template <class V> static inline void set_value(V *val, long k, double v) { val[k] = (V)v; }
+template <> inline void set_value<unit>(unit *val, long k, double v) {}
+
 static void print_string_stdout(const char *s)
 {
 	fputs(s,stdout);
@@ -44,15 +229,300 @@ static void info(const char *fmt,...)
 static void info(const char *fmt,...) {}
 #endif
 
-class l2r_lr_fun: public function
+// The random numbers of the solvers, seeded from param->seed as training
+// starts. Each thread has its own, so models trained at the same time by
+// different threads neither race nor change each other's numbers.
+static thread_local rng solver_rng;
+
+// Memory the solvers take their work arrays from instead of new[]. A
+// work_frame hands arrays out of large blocks in stack order and gives
+// them all back when it ends, but the blocks stay: a workspace kept
+// across calls lets every class, fold or C after the first train with no
+// allocation. When no frame is open, a workspace that needed several
+// blocks merges them into one of their total size.
+struct workspace
+{
+	struct block
+	{
+		char *base;
+		size_t size;
+	};
+	std::vector<block> blocks;
+	size_t cur;	// the block arrays are taken from
+	size_t used;	// bytes of it in use
+	int nr_frame;
+	thread_pool pool;	// the threads of the solvers, kept as the memory is
+
+	workspace(): cur(0), used(0), nr_frame(0) {}
+	~workspace()
+	{
+		for(size_t k=0;k<blocks.size();k++)
+			free(blocks[k].base);
+	}
+
+	// an array of n T's, which stays until the innermost work_frame ends
+	template <class T> T *take(size_t n) { return (T *)take_bytes(n*sizeof(T)); }
+
+	void *take_bytes(size_t size)
+	{
+		size = (size+63) & ~(size_t)63;	// keep arrays on their own cache lines
+		if(!blocks.empty() && used+size <= blocks[cur].size)
+		{
+			used += size;
+			return blocks[cur].base+used-size;
+		}
+		// the rest of this block is left unused until the next merge
+		while(cur+1 < blocks.size())
+		{
+			cur++;
+			if(size <= blocks[cur].size)
+			{
+				used = size;
+				return blocks[cur].base;
+			}
+		}
+		size_t total = 0;
+		for(size_t k=0;k<blocks.size();k++)
+			total += blocks[k].size;
+		block b;
+		b.size = max(size, max(total, (size_t)1<<20));
+		b.base = (char *)malloc(b.size);
+		// the same failure as the new[] the arrays came from before
+		if(b.base == NULL)
+			throw std::bad_alloc();
+		blocks.push_back(b);
+		cur = blocks.size()-1;
+		used = size;
+		return b.base;
+	}
+
+	void merge()
+	{
+		if(blocks.size() <= 1)
+			return;
+		block b;
+		b.size = 0;
+		for(size_t k=0;k<blocks.size();k++)
+		{
+			b.size += blocks[k].size;
+			free(blocks[k].base);
+		}
+		cur = 0;
+		used = 0;
+		// merging only saves later allocations, and this runs as a frame
+		// ends, so without the memory the workspace starts empty instead
+		b.base = (char *)malloc(b.size);
+		if(b.base == NULL)
+			blocks.clear();
+		else
+			blocks.assign(1, b);
+	}
+};
+
+// gives back all that is taken from ws in its scope
+class work_frame
+{
+public:
+	work_frame(workspace *ws): ws(ws), cur(ws->cur), used(ws->used) { ws->nr_frame++; }
+	~work_frame()
+	{
+		ws->cur = cur;
+		ws->used = used;
+		if(--ws->nr_frame == 0)
+			ws->merge();
+	}
+
+private:
+	workspace *ws;
+	size_t cur, used;
+};
+
+template <class P, class V> static void transpose(const P *prob, csr_view<V> *prob_col);
+template <class V> static void free_transpose(csr_view<V> *prob_col);
+
+// Products with the data matrix X for the primal solvers, computed on
+// nr_thread threads. Xv splits the rows among them. For XTv each thread
+// sums its rows into a vector of its own, and the vectors are then added
+// up a range of features per thread. With one thread both are the plain
+// loops; more threads change only the order of the sums in XTv. Problems
+// of fewer than MIN_ROWS_PER_THREAD rows a thread use fewer threads.
+//
+// If by_column is set, a copy of X by columns is kept as well, and XTv
+// gathers each of its elements from a column instead of scattering the
+// rows over all of them. The columns list their rows in order, so the
+// sums are added up exactly as in the loop over rows, on any number of
+// threads.
+template <class P> class parallel_matvec
+{
+public:
+	parallel_matvec(const P *prob, int nr_thread, bool by_column, workspace *ws);
+	~parallel_matvec();
+
+	// Xv[i] = x_{I[i]}^T v for i < sizeI, where I[i] = i if I is NULL
+	void Xv(const int *I, int sizeI, const double *v, double *Xv);
+	// XTv = sum of v[i] x_{I[i]} for i < sizeI
+	void XTv(const int *I, int sizeI, const double *v, double *XTv) { sum_rows<false>(I, sizeI, v, XTv); }
+	// the same with each x_{I[i]} squared elementwise, for the diagonal
+	// of X^T diag(v) X
+	void X2Tv(const int *I, int sizeI, const double *v, double *X2Tv) { sum_rows<true>(I, sizeI, v, X2Tv); }
+
+private:
+	// threads worth using for sizeI rows
+	int threads_for(int sizeI) { return max(min(nr_thread, sizeI/MIN_ROWS_PER_THREAD), 1); }
+	template <bool squared> void sum_rows(const int *I, int sizeI, const double *v, double *XTv);
+	template <bool squared> void sum_rows_by_column(const int *I, int sizeI, const double *v, double *XTv);
+
+	enum { MIN_ROWS_PER_THREAD = 1024 };
+	const P *prob;
+	int nr_thread;
+	thread_pool *pool;
+	double *part;	// nr_thread-1 vectors of size n for XTv
+	bool by_column;
+	csr_view<typename value_of<P>::type> cols;
+	double *v_row;	// v by rows of X for XTv on a subset of them
+};
+
+template <class P> parallel_matvec<P>::parallel_matvec(const P *prob, int nr_thread, bool by_column, workspace *ws)
+{
+	this->prob = prob;
+	this->nr_thread = min(get_nr_thread(nr_thread), max(prob->l/MIN_ROWS_PER_THREAD, 1));
+	this->by_column = by_column;
+	pool = &ws->pool;
+	part = NULL;
+	v_row = NULL;
+	if(by_column)
+	{
+		transpose(prob, &cols);
+		v_row = ws->take<double>(prob->l);
+	}
+	else if(this->nr_thread > 1)
+		part = ws->take<double>((size_t)(this->nr_thread-1)*prob->n);
+}
+
+template <class P> parallel_matvec<P>::~parallel_matvec()
+{
+	if(by_column)
+		free_transpose(&cols);
+}
+
+template <class P> void parallel_matvec<P>::Xv(const int *I, int sizeI, const double *v, double *Xv)
+{
+	int nr = threads_for(sizeI);
+	pool->run(nr, [&](int k) {
+		int first = (int)((long)sizeI*k/nr), last = (int)((long)sizeI*(k+1)/nr);
+		for(int i=first;i<last;i++)
+		{
+			Xv[i]=0;
+			for(auto s=row(prob,(I != NULL)? I[i]: i); s.valid(); s.next())
+				Xv[i]+=v[s.index()-1]*s.value();
+		}
+	});
+}
+
+template <class P> template <bool squared> void parallel_matvec<P>::sum_rows(const int *I, int sizeI, const double *v, double *XTv)
+{
+	if(by_column)
+	{
+		sum_rows_by_column<squared>(I, sizeI, v, XTv);
+		return;
+	}
+
+	int n = prob->n;
+	int nr = threads_for(sizeI);
+	pool->run(nr, [&](int k) {
+		double *sum = (k == 0)? XTv: &part[(size_t)(k-1)*n];
+		int first = (int)((long)sizeI*k/nr), last = (int)((long)sizeI*(k+1)/nr);
+		for(int j=0;j<n;j++)
+			sum[j]=0;
+		for(int i=first;i<last;i++)
+		{
+			for(auto s=row(prob,(I != NULL)? I[i]: i); s.valid(); s.next())
+			{
+				double x = s.value();
+				sum[s.index()-1]+=v[i]*(squared? x*x: x);
+			}
+		}
+	});
+	if(nr == 1)
+		return;
+	pool->run(nr, [&](int k) {
+		int first = (int)((long)n*k/nr), last = (int)((long)n*(k+1)/nr);
+		for(int t=1;t<nr;t++)
+		{
+			const double *sum = &part[(size_t)(t-1)*n];
+			for(int j=first;j<last;j++)
+				XTv[j] += sum[j];
+		}
+	});
+}
+
+template <class P> template <bool squared> void parallel_matvec<P>::sum_rows_by_column(const int *I, int sizeI, const double *v, double *XTv)
+{
+	int n = prob->n;
+	int nr = nr_thread;
+
+	// rows not in I take no part
+	if(I != NULL)
+	{
+		for(int i=0;i<prob->l;i++)
+			v_row[i] = 0;
+		for(int i=0;i<sizeI;i++)
+			v_row[I[i]] = v[i];
+		v = v_row;
+	}
+
+	pool->run(nr, [&](int k) {
+		int first = (int)((long)n*k/nr), last = (int)((long)n*(k+1)/nr);
+		for(int j=first;j<last;j++)
+		{
+			double sum=0;
+			for(auto s=row(&cols,j); s.valid(); s.next())
+			{
+				double x = s.value();
+				sum+=v[s.index()-1]*(squared? x*x: x);
+			}
+			XTv[j]=sum;
+		}
+	});
+}
+
+static int compare_int(const void *a, const void *b)
+{
+	int x = *(const int *)a, y = *(const int *)b;
+	return (x > y) - (x < y);
+}
+
+// Draw ceil(frac*sizeI) of the rows I[0], ..., I[sizeI-1] (0, ..., l-1 if
+// I is NULL) at random into S, in increasing order so that the products
+// walk the data forward, and return their number. S has room for sizeI.
+static int sample_rows(const int *I, int sizeI, double frac, int *S)
+{
+	int i;
+	int sizeS = min((int)ceil(frac*sizeI), sizeI);
+	for(i=0;i<sizeI;i++)
+		S[i] = (I != NULL)? I[i]: i;
+	for(i=0;i<sizeS;i++)
+		swap(S[i], S[i+solver_rng.uniform(sizeI-i)]);
+	qsort(S, sizeS, sizeof(int), compare_int);
+	return sizeS;
+}
+
+// true if param asks the primal solvers for a sampled Hessian
+static bool sample_hessian(const parameter *param)
+{
+	return param->hessian_sample > 0 && param->hessian_sample < 1;
+}
+
+template <class P> class l2r_lr_fun: public function
 {
 public:
-	l2r_lr_fun(const problem *prob, double *C);
+	l2r_lr_fun(const P *prob, double *C, const parameter *param, workspace *ws);
 	~l2r_lr_fun();
 
 	double fun(double *w);
 	void grad(double *w, double *g);
 	void Hv(double *s, double *Hs);
+	void get_diag_preconditioner(double *M);
 
 	int get_nr_variable(void);
 
@@ -63,28 +533,41 @@ private:
 	double *C;
 	double *z;
 	double *D;
-	const problem *prob;
+	double *sigma;	// 1/(1+exp(-y_i w^T x_i)) from the last fun(), for grad()
+	double *wa;
+	// the rows Hv() sums over, drawn by grad() if the Hessian is
+	// sampled, or NULL for all of them
+	int *S;
+	int sizeS;
+	double hessian_sample;
+	const P *prob;
+	parallel_matvec<P> X;
 };
 
-l2r_lr_fun::l2r_lr_fun(const problem *prob, double *C)
+// the arrays are taken from ws, and last as long as the caller's frame
+template <class P> l2r_lr_fun<P>::l2r_lr_fun(const P *prob, double *C, const parameter *param, workspace *ws):
+	X(prob, param->nr_thread, param->by_column != 0, ws)
 {
 	int l=prob->l;
 
 	this->prob = prob;
 
-	z = new double[l];
-	D = new double[l];
+	z = ws->take<double>(l);
+	D = ws->take<double>(l);
+	sigma = ws->take<double>(l);
+	wa = ws->take<double>(l);
+	S = sample_hessian(param)? ws->take<int>(l): NULL;
+	sizeS = l;
+	hessian_sample = param->hessian_sample;
 	this->C = C;
 }
 
-l2r_lr_fun::~l2r_lr_fun()
+template <class P> l2r_lr_fun<P>::~l2r_lr_fun()
 {
-	delete[] z;
-	delete[] D;
 }
 
 
-double l2r_lr_fun::fun(double *w)
+template <class P> double l2r_lr_fun<P>::fun(double *w)
 {
 	int i;
 	double f=0;
@@ -97,19 +580,29 @@ double l2r_lr_fun::fun(double *w)
 	for(i=0;i<w_size;i++)
 		f += w[i]*w[i];
 	f /= 2.0;
+	// the exponential of each loss term also gives the sigmoid grad()
+	// needs, so that no exp() is left for it to do
 	for(i=0;i<l;i++)
 	{
 		double yz = y[i]*z[i];
 		if (yz >= 0)
-			f += C[i]*log(1 + exp(-yz));
+		{
+			double e = exp(-yz);
+			f += C[i]*log(1 + e);
+			sigma[i] = 1/(1 + e);
+		}
 		else
-			f += C[i]*(-yz+log(1 + exp(yz)));
+		{
+			double e = exp(yz);
+			f += C[i]*(-yz+log(1 + e));
+			sigma[i] = e/(1 + e);
+		}
 	}
 
 	return(f);
 }
 
-void l2r_lr_fun::grad(double *w, double *g)
+template <class P> void l2r_lr_fun<P>::grad(double *w, double *g)
 {
 	int i;
 	double *y=prob->y;
@@ -118,121 +611,125 @@ void l2r_lr_fun::grad(double *w, double *g)
 
 	for(i=0;i<l;i++)
 	{
-		z[i] = 1/(1 + exp(-y[i]*z[i]));
-		D[i] = z[i]*(1-z[i]);
-		z[i] = C[i]*(z[i]-1)*y[i];
+		D[i] = sigma[i]*(1-sigma[i]);
+		z[i] = C[i]*(sigma[i]-1)*y[i];
 	}
 	XTv(z, g);
 
 	for(i=0;i<w_size;i++)
 		g[i] = w[i] + g[i];
+
+	if(S != NULL)
+		sizeS = sample_rows(NULL, l, hessian_sample, S);
 }
 
-int l2r_lr_fun::get_nr_variable(void)
+template <class P> int l2r_lr_fun<P>::get_nr_variable(void)
 {
 	return prob->n;
 }
 
-void l2r_lr_fun::Hv(double *s, double *Hs)
+// With a sampled Hessian the terms of the rows in S are scaled by
+// l/sizeS to stand for all of them; otherwise the scale is 1.
+template <class P> void l2r_lr_fun<P>::Hv(double *s, double *Hs)
 {
 	int i;
-	int l=prob->l;
 	int w_size=get_nr_variable();
-	double *wa = new double[l];
+	double scale = (double)prob->l/sizeS;
 
-	Xv(s, wa);
-	for(i=0;i<l;i++)
-		wa[i] = C[i]*D[i]*wa[i];
+	X.Xv(S, sizeS, s, wa);
+	for(i=0;i<sizeS;i++)
+	{
+		int r = (S != NULL)? S[i]: i;
+		wa[i] = C[r]*D[r]*wa[i]*scale;
+	}
 
-	XTv(wa, Hs);
+	X.XTv(S, sizeS, wa, Hs);
 	for(i=0;i<w_size;i++)
 		Hs[i] = s[i] + Hs[i];
-	delete[] wa;
 }
 
-void l2r_lr_fun::Xv(double *v, double *Xv)
+template <class P> void l2r_lr_fun<P>::get_diag_preconditioner(double *M)
 {
 	int i;
-	int l=prob->l;
-	feature_node **x=prob->x;
+	int w_size=get_nr_variable();
+	double scale = (double)prob->l/sizeS;
 
-	for(i=0;i<l;i++)
+	for(i=0;i<sizeS;i++)
 	{
-		feature_node *s=x[i];
-		Xv[i]=0;
-		while(s->index!=-1)
-		{
-			Xv[i]+=v[s->index-1]*s->value;
-			s++;
-		}
+		int r = (S != NULL)? S[i]: i;
+		wa[i] = C[r]*D[r]*scale;
 	}
+	X.X2Tv(S, sizeS, wa, M);
+	for(i=0;i<w_size;i++)
+		M[i] = 1 + M[i];
 }
 
-void l2r_lr_fun::XTv(double *v, double *XTv)
+template <class P> void l2r_lr_fun<P>::Xv(double *v, double *Xv)
 {
-	int i;
-	int l=prob->l;
-	int w_size=get_nr_variable();
-	feature_node **x=prob->x;
+	X.Xv(NULL, prob->l, v, Xv);
+}
 
-	for(i=0;i<w_size;i++)
-		XTv[i]=0;
-	for(i=0;i<l;i++)
-	{
-		feature_node *s=x[i];
-		while(s->index!=-1)
-		{
-			XTv[s->index-1]+=v[i]*s->value;
-			s++;
-		}
-	}
+template <class P> void l2r_lr_fun<P>::XTv(double *v, double *XTv)
+{
+	X.XTv(NULL, prob->l, v, XTv);
 }
 
-class l2r_l2_svc_fun: public function
+template <class P> class l2r_l2_svc_fun: public function
 {
 public:
-	l2r_l2_svc_fun(const problem *prob, double *C);
+	l2r_l2_svc_fun(const P *prob, double *C, const parameter *param, workspace *ws);
 	~l2r_l2_svc_fun();
 
 	double fun(double *w);
 	void grad(double *w, double *g);
 	void Hv(double *s, double *Hs);
+	void get_diag_preconditioner(double *M);
 
 	int get_nr_variable(void);
 
 protected:
 	void Xv(double *v, double *Xv);
-	void subXv(double *v, double *Xv);
 	void subXTv(double *v, double *XTv);
+	void draw_hessian_rows();
 
 	double *C;
 	double *z;
 	double *D;
 	int *I;
 	int sizeI;
-	const problem *prob;
+	// the rows of I Hv() sums over, drawn if the Hessian is sampled, or
+	// NULL for all of them
+	int *S;
+	int sizeS;
+	double hessian_sample;
+	double *wa;
+	const P *prob;
+	parallel_matvec<P> X;
 };
 
-l2r_l2_svc_fun::l2r_l2_svc_fun(const problem *prob, double *C)
+// the arrays are taken from ws, and last as long as the caller's frame
+template <class P> l2r_l2_svc_fun<P>::l2r_l2_svc_fun(const P *prob, double *C, const parameter *param, workspace *ws):
+	X(prob, param->nr_thread, param->by_column != 0, ws)
 {
 	int l=prob->l;
 
 	this->prob = prob;
 
-	z = new double[l];
-	D = new double[l];
-	I = new int[l];
+	z = ws->take<double>(l);
+	D = ws->take<double>(l);
+	I = ws->take<int>(l);
+	S = sample_hessian(param)? ws->take<int>(l): NULL;
+	sizeS = 0;
+	hessian_sample = param->hessian_sample;
+	wa = ws->take<double>(l);
 	this->C = C;
 }
 
-l2r_l2_svc_fun::~l2r_l2_svc_fun()
+template <class P> l2r_l2_svc_fun<P>::~l2r_l2_svc_fun()
 {
-	delete[] z;
-	delete[] D;
-	delete[] I;
 }
 
-double l2r_l2_svc_fun::fun(double *w)
+template <class P> double l2r_l2_svc_fun<P>::fun(double *w)
 {
 	int i;
 	double f=0;
@@ -256,7 +753,7 @@ double l2r_l2_svc_fun::fun(double *w)
 	return(f);
 }
 
-void l2r_l2_svc_fun::grad(double *w, double *g)
+template <class P> void l2r_l2_svc_fun<P>::grad(double *w, double *g)
 {
 	int i;
 	double *y=prob->y;
@@ -275,87 +772,70 @@ void l2r_l2_svc_fun::grad(double *w, double *g)
 
 	for(i=0;i<w_size;i++)
 		g[i] = w[i] + 2*g[i];
+
+	draw_hessian_rows();
+}
+
+// for a sampled Hessian, the rows of the new I that Hv() is to use
+template <class P> void l2r_l2_svc_fun<P>::draw_hessian_rows()
+{
+	if(S != NULL)
+		sizeS = sample_rows(I, sizeI, hessian_sample, S);
 }
 
-int l2r_l2_svc_fun::get_nr_variable(void)
+template <class P> int l2r_l2_svc_fun<P>::get_nr_variable(void)
 {
 	return prob->n;
 }
 
-void l2r_l2_svc_fun::Hv(double *s, double *Hs)
+// With a sampled Hessian the terms of the rows in S are scaled by
+// sizeI/sizeS to stand for all of I; otherwise the scale is 1.
+template <class P> void l2r_l2_svc_fun<P>::Hv(double *s, double *Hs)
 {
 	int i;
 	int w_size=get_nr_variable();
-	double *wa = new double[sizeI];
+	const int *H = (S != NULL)? S: I;
+	int sizeH = (S != NULL)? sizeS: sizeI;
+	double scale = (sizeH > 0)? (double)sizeI/sizeH: 1;
 
-	subXv(s, wa);
-	for(i=0;i<sizeI;i++)
-		wa[i] = C[I[i]]*wa[i];
+	X.Xv(H, sizeH, s, wa);
+	for(i=0;i<sizeH;i++)
+		wa[i] = C[H[i]]*wa[i]*scale;
 
-	subXTv(wa, Hs);
+	X.XTv(H, sizeH, wa, Hs);
 	for(i=0;i<w_size;i++)
 		Hs[i] = s[i] + 2*Hs[i];
-	delete[] wa;
 }
 
-void l2r_l2_svc_fun::Xv(double *v, double *Xv)
+template <class P> void l2r_l2_svc_fun<P>::get_diag_preconditioner(double *M)
 {
 	int i;
-	int l=prob->l;
-	feature_node **x=prob->x;
+	int w_size=get_nr_variable();
+	const int *H = (S != NULL)? S: I;
+	int sizeH = (S != NULL)? sizeS: sizeI;
+	double scale = (sizeH > 0)? (double)sizeI/sizeH: 1;
 
-	for(i=0;i<l;i++)
-	{
-		feature_node *s=x[i];
-		Xv[i]=0;
-		while(s->index!=-1)
-		{
-			Xv[i]+=v[s->index-1]*s->value;
-			s++;
-		}
-	}
+	for(i=0;i<sizeH;i++)
+		wa[i] = C[H[i]]*scale;
+	X.X2Tv(H, sizeH, wa, M);
+	for(i=0;i<w_size;i++)
+		M[i] = 1 + 2*M[i];
 }
 
-void l2r_l2_svc_fun::subXv(double *v, double *Xv)
+template <class P> void l2r_l2_svc_fun<P>::Xv(double *v, double *Xv)
 {
-	int i;
-	feature_node **x=prob->x;
-
-	for(i=0;i<sizeI;i++)
-	{
-		feature_node *s=x[I[i]];
-		Xv[i]=0;
-		while(s->index!=-1)
-		{
-			Xv[i]+=v[s->index-1]*s->value;
-			s++;
-		}
-	}
+	X.Xv(NULL, prob->l, v, Xv);
 }
 
-void l2r_l2_svc_fun::subXTv(double *v, double *XTv)
+template <class P> void l2r_l2_svc_fun<P>::subXTv(double *v, double *XTv)
 {
-	int i;
-	int w_size=get_nr_variable();
-	feature_node **x=prob->x;
-
-	for(i=0;i<w_size;i++)
-		XTv[i]=0;
-	for(i=0;i<sizeI;i++)
-	{
-		feature_node *s=x[I[i]];
-		while(s->index!=-1)
-		{
-			XTv[s->index-1]+=v[i]*s->value;
-			s++;
-		}
-	}
+	X.XTv(I, sizeI, v, XTv);
 }
 
-class l2r_l2_svr_fun: public l2r_l2_svc_fun
+template <class P> class l2r_l2_svr_fun: public l2r_l2_svc_fun<P>
 {
 public:
-	l2r_l2_svr_fun(const problem *prob, double *C, double p);
+	l2r_l2_svr_fun(const P *prob, double *C, const parameter *param, workspace *ws);
 
 	double fun(double *w);
 	void grad(double *w, double *g);
@@ -364,22 +844,24 @@ private:
 	double p;
 };
 
-l2r_l2_svr_fun::l2r_l2_svr_fun(const problem *prob, double *C, double p):
-	l2r_l2_svc_fun(prob, C)
+template <class P> l2r_l2_svr_fun<P>::l2r_l2_svr_fun(const P *prob, double *C, const parameter *param, workspace *ws):
+	l2r_l2_svc_fun<P>(prob, C, param, ws)
 {
-	this->p = p;
+	this->p = param->p;
 }
 
-double l2r_l2_svr_fun::fun(double *w)
+template <class P> double l2r_l2_svr_fun<P>::fun(double *w)
 {
 	int i;
 	double f=0;
-	double *y=prob->y;
-	int l=prob->l;
-	int w_size=get_nr_variable();
+	double *y=this->prob->y;
+	int l=this->prob->l;
+	int w_size=this->get_nr_variable();
+	double *z=this->z;
+	double *C=this->C;
 	double d;
 
-	Xv(w, z);
+	this->Xv(w, z);
 
 	for(i=0;i<w_size;i++)
 		f += w[i]*w[i];
@@ -396,12 +878,16 @@ double l2r_l2_svr_fun::fun(double *w)
 	return(f);
 }
 
-void l2r_l2_svr_fun::grad(double *w, double *g)
+template <class P> void l2r_l2_svr_fun<P>::grad(double *w, double *g)
 {
 	int i;
-	double *y=prob->y;
-	int l=prob->l;
-	int w_size=get_nr_variable();
+	double *y=this->prob->y;
+	int l=this->prob->l;
+	int w_size=this->get_nr_variable();
+	double *z=this->z;
+	double *C=this->C;
+	int *I=this->I;
+	int &sizeI=this->sizeI;
 	double d;
 
 	sizeI = 0;
@@ -424,270 +910,985 @@ void l2r_l2_svr_fun::grad(double *w, double *g)
 		}
 
 	}
-	subXTv(z, g);
+	this->subXTv(z, g);
 
 	for(i=0;i<w_size;i++)
 		g[i] = w[i] + 2*g[i];
-}
-
-// A coordinate descent algorithm for 
-// multi-class support vector machines by Crammer and Singer
-//
-//  min_{\alpha}  0.5 \sum_m ||w_m(\alpha)||^2 + \sum_i \sum_m e^m_i alpha^m_i
-//    s.t.     \alpha^m_i <= C^m_i \forall m,i , \sum_m \alpha^m_i=0 \forall i
-// 
-//  where e^m_i = 0 if y_i  = m,
-//        e^m_i = 1 if y_i != m,
-//  C^m_i = C if m  = y_i, 
-//  C^m_i = 0 if m != y_i, 
-//  and w_m(\alpha) = \sum_i \alpha^m_i x_i 
-//
-// Given: 
-// x, y, C
-// eps is the stopping tolerance
-//
-// solution will be put in w
-//
-// See Appendix of LIBLINEAR paper, Fan et al. (2008)
 
-#define GETI(i) ((int) prob->y[i])
-// To support weights for instances, use GETI(i) (i)
+	this->draw_hessian_rows();
+}
 
-class Solver_MCSVM_CS
+// How the dual CD solvers read and update w. With one thread w is a
+// plain array. With several, each thread takes a slice of the shuffled
+// instances and they share w with no locks, as in PASSCoDe-Wild (Hsieh
+// et al., ICML 2015): loads and stores are relaxed atomics, so a thread
+// sees the others' updates as they happen, and of two updates of the same
+// element at the same time one may be lost. The solver rebuilds w from
+// alpha when it is done.
+struct serial_w
 {
-	public:
-		Solver_MCSVM_CS(const problem *prob, int nr_class, double *C, double eps=0.1, int max_iter=100000);
-		~Solver_MCSVM_CS();
-		void Solve(double *w);
-	private:
-		void solve_sub_problem(double A_i, int yi, double C_yi, int active_i, double *alpha_new);
-		bool be_shrunk(int i, int m, int yi, double alpha_i, double minG);
-		double *B, *C, *G;
-		int w_size, l;
-		int nr_class;
-		int max_iter;
-		double eps;
-		const problem *prob;
+	static const bool shared = false;
+	static double get(const double *w, int j) { return w[j]; }
+	static void add(double *w, int j, double d) { w[j] += d; }
 };
 
-Solver_MCSVM_CS::Solver_MCSVM_CS(const problem *prob, int nr_class, double *weighted_C, double eps, int max_iter)
+struct wild_w
 {
-	this->w_size = prob->n;
-	this->l = prob->l;
-	this->nr_class = nr_class;
-	this->eps = eps;
-	this->max_iter = max_iter;
-	this->prob = prob;
-	this->B = new double[nr_class];
-	this->G = new double[nr_class];
-	this->C = weighted_C;
-}
+	static const bool shared = true;	// so write only what changes
+	static double get(const double *w, int j)
+	{
+		double v;
+		__atomic_load(&w[j], &v, __ATOMIC_RELAXED);
+		return v;
+	}
+	static void add(double *w, int j, double d)
+	{
+		double v = get(w, j) + d;
+		__atomic_store(&w[j], &v, __ATOMIC_RELAXED);
+	}
+};
 
-Solver_MCSVM_CS::~Solver_MCSVM_CS()
+// Passes of dual CD on this many instances or fewer a thread run on fewer
+// threads.
+enum { MIN_CD_ROWS_PER_THREAD = 1024 };
+
+// the threads worth using for a pass over size instances
+static int cd_threads(int nr_thread, int size)
 {
-	delete[] B;
-	delete[] G;
+	return max(min(nr_thread, size/MIN_CD_ROWS_PER_THREAD), 1);
 }
 
-int compare_double(const void *a, const void *b)
+// Updates lost between threads leave w off \sum_i y_i alpha_i x_i. Before
+// the first parallel pass, take() saves w and alpha[stride*i], which agree
+// then; rebuild() sets w to the saved one plus the change of alpha since.
+struct wild_snapshot
 {
-	if(*(double *)a > *(double *)b)
-		return -1;
-	if(*(double *)a < *(double *)b)
-		return 1;
-	return 0;
+	double *w0, *alpha0;
+	int n, l;
+	bool taken;
+
+	wild_snapshot(int n, int l, int nr_thread, workspace *ws): n(n), l(l), taken(false)
+	{
+		w0 = (nr_thread > 1)? ws->take<double>(n): NULL;
+		alpha0 = (nr_thread > 1)? ws->take<double>(l): NULL;
+	}
+	void take(const double *w, const double *alpha, int stride)
+	{
+		if(taken)
+			return;
+		memcpy(w0, w, sizeof(double)*n);
+		for(int i=0;i<l;i++)
+			alpha0[i] = alpha[(size_t)stride*i];
+		taken = true;
+	}
+	template <class P> void rebuild(const P *prob, const schar *y, double *w, const double *alpha, int stride)
+	{
+		if(!taken)
+			return;
+		memcpy(w, w0, sizeof(double)*n);
+		for(int i=0;i<l;i++)
+		{
+			double d = (y != NULL)? y[i]*(alpha[(size_t)stride*i]-alpha0[i]): alpha[(size_t)stride*i]-alpha0[i];
+			if(d != 0)
+				for(auto xi=row(prob,i); xi.valid(); xi.next())
+					w[xi.index()-1] += d*xi.value();
+		}
+	}
+};
+
+// Move the instances index[s] with shrunk[s] unset to the front of
+// index[0], ..., index[size-1], and return their number.
+static int compact_active(int *index, const char *shrunk, int size)
+{
+	int n = 0;
+	for(int s=0;s<size;s++)
+		if(!shrunk[s])
+		{
+			swap(index[n], index[s]);
+			n++;
+		}
+	return n;
+}
+
+// The order of a pass of dual CD over index[0], ..., index[size-1]: a
+// shuffle, or with block > 0, the instances i with the same i/block taken
+// together, the blocks in a shuffled order and each block shuffled in
+// turn. The rows of a block lie close together in memory, and the w of
+// the features they share stays in cache from one instance to the next.
+struct cd_order
+{
+	int block, nr_block;
+	int *perm, *rank, *start, *tmp;
+
+	cd_order(int l, int block_size, workspace *ws):
+		block(max(block_size, 0)), perm(NULL), rank(NULL), start(NULL), tmp(NULL)
+	{
+		nr_block = (block > 0)? (int)(((long)l+block-1)/block): 1;
+		if(nr_block > 1)
+		{
+			perm = ws->take<int>(nr_block);
+			rank = ws->take<int>(nr_block);
+			start = ws->take<int>(nr_block+1);
+			tmp = ws->take<int>(l);
+		}
+	}
+
+	void shuffle(int *index, int size)
+	{
+		int i, b;
+		if(nr_block <= 1)
+		{
+			for(i=0; i<size; i++)
+				swap(index[i], index[i+solver_rng.uniform(size-i)]);
+			return;
+		}
+		for(b=0; b<nr_block; b++)
+			perm[b] = b;
+		for(b=0; b<nr_block; b++)
+		{
+			swap(perm[b], perm[b+solver_rng.uniform(nr_block-b)]);
+			rank[perm[b]] = b;
+		}
+		// a counting sort of the instances by the rank of their block
+		for(b=0; b<=nr_block; b++)
+			start[b] = 0;
+		for(i=0; i<size; i++)
+			start[rank[index[i]/block]+1]++;
+		for(b=0; b<nr_block; b++)
+			start[b+1] += start[b];
+		for(i=0; i<size; i++)
+			tmp[start[rank[index[i]/block]]++] = index[i];
+		// start[b] is now the end of the b-th block in tmp
+		for(b=0, i=0; b<nr_block; b++)
+			for(; i<start[b]; i++)
+				swap(tmp[i], tmp[i+solver_rng.uniform(start[b]-i)]);
+		memcpy(index, tmp, sizeof(int)*size);
+	}
+};
+
+// Room for nnz values of type V in ws, as new_values()
+template <class V> static V *take_values(workspace *ws, long nnz) { return ws->take<V>((size_t)nnz); }
+template <> unit *take_values<unit>(workspace *ws, long nnz) { return NULL; }
+
+// Shrinking keeps the active instances in index[0], ..., index[active_size-1],
+// but their rows stay where they are in the data, so late passes, with few
+// instances left, still jump about all of it. active_rows copies the active
+// rows one after another, in the order of index[], into a buffer that view
+// serves to row(): instance i is row slot[i] of it. The solver refills it
+// whenever the nonzeros of its active rows drop to half of those it reads,
+// and goes back to the data when it unshrinks. Rows are copied as they
+// are, so the solver takes the same steps on the copy.
+template <class V> struct active_rows
+{
+	csr_view<V> view;
+	int *slot;
+	long total, held;	// nonzeros of the data and of the rows read now
+	int nr_fill;	// fills since the solver last read the data
+	long *row_ptr[2];	// fills alternate between two buffers
+	int *col_idx[2];
+	V *val[2];
+	workspace *ws;
+
+	active_rows(long total, workspace *ws): slot(NULL), total(total), held(total), nr_fill(0), ws(ws) {}
+
+	// whether active rows with nnz nonzeros are worth a copy
+	bool worth(long nnz) const { return nnz > 0 && nnz <= held/2; }
+
+	// Copy the rows of index[0], ..., index[active_size-1], which have nnz
+	// nonzeros, from prob, the data or view itself.
+	template <class P> const csr_view<V> *fill(const P *prob, const int *index, int active_size, long nnz)
+	{
+		if(slot == NULL)
+		{
+			// a fill holds at most half the nonzeros of the one before
+			slot = ws->take<int>(prob->l);
+			for(int b=0;b<2;b++)
+			{
+				row_ptr[b] = ws->take<long>(prob->l+1);
+				col_idx[b] = ws->take<int>(total/(2<<b));
+				val[b] = take_values<V>(ws, total/(2<<b));
+			}
+		}
+		int b = nr_fill%2;
+		long k = 0;
+		for(int s=0;s<active_size;s++)
+		{
+			row_ptr[b][s] = k;
+			for(auto xi=row(prob,index[s]); xi.valid(); xi.next())
+			{
+				col_idx[b][k] = xi.index();
+				set_value(val[b], k, xi.value());
+				k++;
+			}
+		}
+		row_ptr[b][active_size] = k;
+		// after the rows are read, as prob may be view
+		for(int s=0;s<active_size;s++)
+			slot[index[s]] = s;
+		view.l = prob->l;
+		view.n = prob->n;
+		view.y = prob->y;
+		view.bias = prob->bias;
+		view.row_ptr = row_ptr[b];
+		view.col_idx = col_idx[b];
+		view.val = val[b];
+		view.perm = slot;
+		held = nnz;
+		nr_fill++;
+		return &view;
+	}
+
+	void reset()
+	{
+		held = total;
+		nr_fill = 0;
+	}
+};
+
+// A coordinate descent algorithm for 
+// multi-class support vector machines by Crammer and Singer
+//
+//  min_{\alpha}  0.5 \sum_m ||w_m(\alpha)||^2 + \sum_i \sum_m e^m_i alpha^m_i
+//    s.t.     \alpha^m_i <= C^m_i \forall m,i , \sum_m \alpha^m_i=0 \forall i
+// 
+//  where e^m_i = 0 if y_i  = m,
+//        e^m_i = 1 if y_i != m,
+//  C^m_i = C if m  = y_i, 
+//  C^m_i = 0 if m != y_i, 
+//  and w_m(\alpha) = \sum_i \alpha^m_i x_i 
+//
+// Given: 
+// x, y, C
+// eps is the stopping tolerance
+//
+// solution will be put in w
+//
+// See Appendix of LIBLINEAR paper, Fan et al. (2008)
+
+#define GETI(i) ((int) prob->y[i])
+// To support weights for instances, use GETI(i) (i)
+
+// The dual variables of instance i are kept as a list of (class, alpha)
+// pairs, ent[i][0], ..., ent[i][nr_ent[i]-1]. While all classes of i are
+// active (nr_active[i] == nr_class) the list holds its nonzero alphas;
+// else first its nr_active[i] active classes, then the inactive classes
+// with a nonzero alpha, which can only be the label at C. Every other
+// alpha is 0, so memory grows with the nonzeros and the active classes
+// rather than with l*nr_class.
+struct cs_entry
+{
+	int m;
+	double alpha;
+};
+
+// The nonzero alphas of a solution, kept between solves, e.g., along a
+// path of C: those of instance i are ent[start[i]], ..., ent[start[i+1]-1],
+// in class order. Empty until a solve fills it.
+struct cs_duals
+{
+	cs_entry *ent;
+	size_t *start;
+
+	cs_duals(): ent(NULL), start(NULL) {}
+	~cs_duals() { free(ent); free(start); }
+};
+
+// Room for the lists, handed out from large chunks that stay put while a
+// pass runs; each thread has its own. A list that outgrows its room moves
+// to new room and leaves the old unused until the solver packs the lists
+// together again.
+struct cs_pool
+{
+	std::vector<cs_entry *> chunks;
+	cs_entry *next;
+	size_t left;
+	size_t used;	// entries handed out
+
+	cs_pool(): next(NULL), left(0), used(0) {}
+	~cs_pool() { clear(); }
+
+	cs_entry *take(size_t n)
+	{
+		if(n > left)
+		{
+			left = max(n, (size_t)1<<16);
+			next = Malloc(cs_entry, left);
+			chunks.push_back(next);
+		}
+		cs_entry *p = next;
+		next += n;
+		left -= n;
+		used += n;
+		return p;
+	}
+
+	void clear()
+	{
+		for(size_t k=0;k<chunks.size();k++)
+			free(chunks[k]);
+		chunks.clear();
+		next = NULL;
+		left = 0;
+		used = 0;
+	}
+};
+
+// the work arrays of a thread, nr_class long
+struct cs_scratch
+{
+	double *G, *B, *D, *alpha, *alpha_new, *G_class, *d_class, *d_val;
+	int *cls, *d_ind;
+	cs_entry *list;
+};
+
+template <class P> class Solver_MCSVM_CS
+{
+	public:
+		Solver_MCSVM_CS(const P *prob, int nr_class, double *C, int nr_thread, workspace *ws, double eps=0.1, int max_iter=100000);
+		~Solver_MCSVM_CS();
+		void Solve(double *w, double *alpha_init = NULL);
+		void Solve(double *w, cs_duals *duals, double scale);
+	private:
+		void take_lists();
+		void start_lists();
+		void end_lists();
+		void solve(double *w);
+		template <class W> bool update(int i, double *w, cs_scratch &t, cs_pool &pool, double &stopping);
+		void store(int i, const cs_entry *list, int n, int n_active, cs_pool &pool);
+		void pack();
+		void solve_sub_problem(cs_scratch &t, double A_i, int yi, double C_yi, int active_i);
+		bool be_shrunk(int i, int m, int yi, double alpha_i, double G_m, double minG);
+		double *C, *QD;
+		cs_entry **ent;
+		int *nr_ent, *cap, *nr_active;
+		cs_entry *packed;	// the lists as pack() left them
+		size_t nr_packed;
+		std::vector<cs_pool> pools;
+		int w_size, l;
+		int nr_class;
+		int nr_thread;
+		int max_iter;
+		double eps;
+		const P *prob;
+		workspace *ws;
+};
+
+template <class P> Solver_MCSVM_CS<P>::Solver_MCSVM_CS(const P *prob, int nr_class, double *weighted_C, int nr_thread, workspace *ws, double eps, int max_iter):
+	packed(NULL), nr_packed(0), pools(get_nr_thread(nr_thread))
+{
+	this->w_size = prob->n;
+	this->l = prob->l;
+	this->nr_class = nr_class;
+	this->nr_thread = get_nr_thread(nr_thread);
+	this->eps = eps;
+	this->max_iter = max_iter;
+	this->prob = prob;
+	this->ws = ws;
+	this->C = weighted_C;
+}
+
+template <class P> Solver_MCSVM_CS<P>::~Solver_MCSVM_CS()
+{
+	free(packed);
+}
+
+// Classes up to which solve_sub_problem() sorts D by insertion; it keeps
+// more of them in a heap.
+enum { MAX_CS_INSERTION_SORT = 16 };
+
+// move D[k] down the max-heap D[0], ..., D[n-1] to its place
+static inline void sift_down(double *D, int n, int k)
+{
+	double v = D[k];
+	for(int c=2*k+1; c<n; c=2*k+1)
+	{
+		if(c+1 < n && D[c+1] > D[c])
+			c++;
+		if(!(D[c] > v))
+			break;
+		D[k] = D[c];
+		k = c;
+	}
+	D[k] = v;
 }
 
-void Solver_MCSVM_CS::solve_sub_problem(double A_i, int yi, double C_yi, int active_i, double *alpha_new)
+template <class P> void Solver_MCSVM_CS<P>::solve_sub_problem(cs_scratch &t, double A_i, int yi, double C_yi, int active_i)
 {
 	int r;
-	double *D;
+	double *B = t.B, *D = t.D;
 
-	clone(D, B, active_i);
+	memcpy(D, B, sizeof(double)*active_i);
 	if(yi < active_i)
 		D[yi] += A_i*C_yi;
-	qsort(D, active_i, sizeof(double), compare_double);
 
-	double beta = D[0] - A_i*C_yi;
-	for(r=1;r<active_i && beta<r*D[r];r++)
-		beta += D[r];
+	// beta reads D from the largest down, and often only its first few,
+	// so a long D is made a heap and its next largest taken as needed
+	double beta;
+	if(active_i <= MAX_CS_INSERTION_SORT)
+	{
+		for(r=1;r<active_i;r++)
+		{
+			double v = D[r];
+			int k = r;
+			for(;k>0 && D[k-1]<v;k--)
+				D[k] = D[k-1];
+			D[k] = v;
+		}
+		beta = D[0] - A_i*C_yi;
+		for(r=1;r<active_i && beta<r*D[r];r++)
+			beta += D[r];
+	}
+	else
+	{
+		int size = active_i;
+		for(r=size/2-1;r>=0;r--)
+			sift_down(D, size, r);
+		beta = D[0] - A_i*C_yi;
+		for(r=1;r<active_i;r++)
+		{
+			D[0] = D[--size];
+			sift_down(D, size, 0);
+			if(!(beta<r*D[0]))
+				break;
+			beta += D[0];
+		}
+	}
 	beta /= r;
 
 	for(r=0;r<active_i;r++)
 	{
 		if(r == yi)
-			alpha_new[r] = min(C_yi, (beta-B[r])/A_i);
+			t.alpha_new[r] = min(C_yi, (beta-B[r])/A_i);
 		else
-			alpha_new[r] = min((double)0, (beta - B[r])/A_i);
+			t.alpha_new[r] = min((double)0, (beta - B[r])/A_i);
 	}
-	delete[] D;
 }
 
-bool Solver_MCSVM_CS::be_shrunk(int i, int m, int yi, double alpha_i, double minG)
+template <class P> bool Solver_MCSVM_CS<P>::be_shrunk(int i, int m, int yi, double alpha_i, double G_m, double minG)
 {
 	double bound = 0;
 	if(m == yi)
 		bound = C[GETI(i)];
-	if(alpha_i == bound && G[m] < minG)
+	if(alpha_i == bound && G_m < minG)
 		return true;
 	return false;
 }
 
-void Solver_MCSVM_CS::Solve(double *w)
+// Make list, of n pairs whose first n_active are the active classes, the
+// list of instance i, moving it to room from pool if it has outgrown its
+// own.
+template <class P> void Solver_MCSVM_CS<P>::store(int i, const cs_entry *list, int n, int n_active, cs_pool &pool)
 {
-	int i, m, s;
-	int iter = 0;
-	double *alpha =  new double[l*nr_class];
-	double *alpha_new = new double[nr_class];
-	int *index = new int[l];
-	double *QD = new double[l];
-	int *d_ind = new int[nr_class];
-	double *d_val = new double[nr_class];
-	int *alpha_index = new int[nr_class*l];
-	int *y_index = new int[l];
-	int active_size = l;
-	int *active_size_i = new int[l];
-	double eps_shrink = max(10.0*eps, 1.0); // stopping tolerance for shrinking
-	bool start_from_all = true;
-
-	// Initial alpha can be set here. Note that 
-	// sum_m alpha[i*nr_class+m] = 0, for all i=1,...,l-1
-	// alpha[i*nr_class+m] <= C[GETI(i)] if prob->y[i] == m
-	// alpha[i*nr_class+m] <= 0 if prob->y[i] != m
-	// If initial alpha isn't zero, uncomment the for loop below to initialize w
-	for(i=0;i<l*nr_class;i++)
-		alpha[i] = 0;
+	if(n > cap[i])
+	{
+		cap[i] = min(max(n, 2*cap[i]), nr_class);
+		ent[i] = pool.take(cap[i]);
+	}
+	memcpy(ent[i], list, sizeof(cs_entry)*n);
+	nr_ent[i] = n;
+	nr_active[i] = n_active;
+}
 
-	for(i=0;i<w_size*nr_class;i++)
-		w[i] = 0;
+// Copy the lists of all instances into one block, each with room for
+// itself alone, and give back the room of the pools.
+template <class P> void Solver_MCSVM_CS<P>::pack()
+{
+	int i;
+	size_t total = 0;
+	for(i=0;i<l;i++)
+		total += nr_ent[i];
+	cs_entry *block = Malloc(cs_entry, max(total, (size_t)1));
+	cs_entry *next = block;
 	for(i=0;i<l;i++)
+	{
+		memcpy(next, ent[i], sizeof(cs_entry)*nr_ent[i]);
+		ent[i] = next;
+		cap[i] = nr_ent[i];
+		next += nr_ent[i];
+	}
+	free(packed);
+	packed = block;
+	nr_packed = total;
+	for(size_t k=0;k<pools.size();k++)
+		pools[k].clear();
+}
+
+// One step of CD on the alphas of instance i, with the work arrays t and
+// room for its list from pool. Returns false if at most one class of i
+// is left active, to have i shrunk; else raises stopping to the
+// violation of i unless it is under 1e-12.
+template <class P> template <class W> bool Solver_MCSVM_CS<P>::update(int i, double *w, cs_scratch &t, cs_pool &pool, double &stopping)
+{
+	int m, r;
+	double Ai = QD[i];
+	if(Ai <= 0)
+		return true;
+
+	// the active classes cls[0], ..., cls[k-1], their alphas in alpha_i
+	// and their gradients in G; yi is the label's place, or k_old if it
+	// is not active
+	double *G = t.G, *alpha_i = t.alpha;
+	int *cls = t.cls;
+	int label = (int)prob->y[i];
+	const cs_entry *e = ent[i];
+	int k_old = nr_active[i], k = k_old;
+	int yi = k_old;
+	int first_inactive = (k_old == nr_class)? nr_ent[i]: k_old;
+	if(k_old == nr_class)
 	{
 		for(m=0;m<nr_class;m++)
-			alpha_index[i*nr_class+m] = m;
-		feature_node *xi = prob->x[i];
-		QD[i] = 0;
-		while(xi->index != -1)
 		{
-			double val = xi->value;
-			QD[i] += val*val;
-
-			// Uncomment the for loop if initial alpha isn't zero
-			// for(m=0; m<nr_class; m++)
-			//	w[(xi->index-1)*nr_class+m] += alpha[i*nr_class+m]*val;
-			xi++;
+			cls[m] = m;
+			alpha_i[m] = 0;
 		}
-		active_size_i[i] = nr_class;
-		y_index[i] = (int)prob->y[i];
-		index[i] = i;
+		for(r=0;r<nr_ent[i];r++)
+			alpha_i[e[r].m] = e[r].alpha;
+		yi = label;
 	}
+	else
+		for(m=0;m<k;m++)
+		{
+			cls[m] = e[m].m;
+			alpha_i[m] = e[m].alpha;
+			if(cls[m] == label)
+				yi = m;
+		}
 
-	while(iter < max_iter)
+	// With most classes active, G is summed over all of them in the order
+	// of w, in loops the compiler vectorizes. Either way each G[m] takes
+	// the same sums.
+	if(2*k >= nr_class)
 	{
-		double stopping = -INF;
-		for(i=0;i<active_size;i++)
+		double *G_class = t.G_class;
+		for(m=0;m<nr_class;m++)
+			G_class[m] = 1;
+		G_class[label] = 0;
+
+		for(auto xi=row(prob,i); xi.valid(); xi.next())
 		{
-			int j = i+rand()%(active_size-i);
-			swap(index[i], index[j]);
+			const double *w_i = &w[(size_t)(xi.index()-1)*nr_class];
+			double val = xi.value();
+			for(m=0;m<nr_class;m++)
+				G_class[m] += W::get(w_i, m)*val;
 		}
-		for(s=0;s<active_size;s++)
+		for(m=0;m<k;m++)
+			G[m] = G_class[cls[m]];
+	}
+	else
+	{
+		for(m=0;m<k;m++)
+			G[m] = 1;
+		if(yi < k)
+			G[yi] = 0;
+
+		for(auto xi=row(prob,i); xi.valid(); xi.next())
 		{
-			i = index[s];
-			double Ai = QD[i];
-			double *alpha_i = &alpha[i*nr_class];
-			int *alpha_index_i = &alpha_index[i*nr_class];
+			const double *w_i = &w[(size_t)(xi.index()-1)*nr_class];
+			for(m=0;m<k;m++)
+				G[m] += W::get(w_i, cls[m])*(xi.value());
+		}
+	}
 
-			if(Ai > 0)
-			{
-				for(m=0;m<active_size_i[i];m++)
-					G[m] = 1;
-				if(y_index[i] < active_size_i[i])
-					G[y_index[i]] = 0;
+	double minG = INF;
+	double maxG = -INF;
+	for(m=0;m<k;m++)
+	{
+		if(alpha_i[m] < 0 && G[m] < minG)
+			minG = G[m];
+		if(G[m] > maxG)
+			maxG = G[m];
+	}
+	if(yi < k)
+		if(alpha_i[yi] < C[GETI(i)] && G[yi] < minG)
+			minG = G[yi];
 
-				feature_node *xi = prob->x[i];
-				while(xi->index!= -1)
+	for(m=0;m<k;m++)
+	{
+		if(be_shrunk(i, m, yi, alpha_i[m], G[m], minG))
+		{
+			k--;
+			while(k>m)
+			{
+				if(!be_shrunk(i, k, yi, alpha_i[k], G[k], minG))
 				{
-					double *w_i = &w[(xi->index-1)*nr_class];
-					for(m=0;m<active_size_i[i];m++)
-						G[m] += w_i[alpha_index_i[m]]*(xi->value);
-					xi++;
+					swap(cls[m], cls[k]);
+					swap(G[m], G[k]);
+					swap(alpha_i[m], alpha_i[k]);
+					if(yi == k)
+						yi = m;
+					else if(yi == m)
+						yi = k;
+					break;
 				}
+				k--;
+			}
+		}
+	}
 
-				double minG = INF;
-				double maxG = -INF;
-				for(m=0;m<active_size_i[i];m++)
-				{
-					if(alpha_i[alpha_index_i[m]] < 0 && G[m] < minG)
-						minG = G[m];
-					if(G[m] > maxG)
-						maxG = G[m];
-				}
-				if(y_index[i] < active_size_i[i])
-					if(alpha_i[(int) prob->y[i]] < C[GETI(i)] && G[y_index[i]] < minG)
-						minG = G[y_index[i]];
+	if(k > 1 && maxG-minG > 1e-12)
+	{
+		stopping = max(maxG - minG, stopping);
+
+		for(m=0;m<k;m++)
+			t.B[m] = G[m] - Ai*alpha_i[m];
+
+		solve_sub_problem(t, Ai, yi, C[GETI(i)], k);
+		int nz_d = 0;
+		for(m=0;m<k;m++)
+		{
+			double d = t.alpha_new[m] - alpha_i[m];
+			alpha_i[m] = t.alpha_new[m];
+			if(fabs(d) >= 1e-12)
+			{
+				t.d_ind[nz_d] = cls[m];
+				t.d_val[nz_d] = d;
+				nz_d++;
+			}
+		}
 
-				for(m=0;m<active_size_i[i];m++)
+		// the same for w; adding 0 leaves an element of w as it was, as
+		// none is ever -0, but on a w shared by threads it would overwrite
+		// what the others add meanwhile
+		if(!W::shared && 2*nz_d >= nr_class)
+		{
+			for(m=0;m<nr_class;m++)
+				t.d_class[m] = 0;
+			for(m=0;m<nz_d;m++)
+				t.d_class[t.d_ind[m]] = t.d_val[m];
+
+			for(auto xi=row(prob,i); xi.valid(); xi.next())
+			{
+				double *w_i = &w[(size_t)(xi.index()-1)*nr_class];
+				double val = xi.value();
+				for(m=0;m<nr_class;m++)
+					W::add(w_i, m, t.d_class[m]*val);
+			}
+		}
+		else
+		{
+			for(auto xi=row(prob,i); xi.valid(); xi.next())
+			{
+				double *w_i = &w[(size_t)(xi.index()-1)*nr_class];
+				for(m=0;m<nz_d;m++)
+					W::add(w_i, t.d_ind[m], t.d_val[m]*xi.value());
+			}
+		}
+	}
+
+	// the new list of i; those shrunk now are at their bounds, so only
+	// the label may be inactive and nonzero
+	int n = 0;
+	cs_entry *list = t.list;
+	if(k == nr_class)
+	{
+		for(m=0;m<k;m++)
+			if(alpha_i[m] != 0)
+			{
+				list[n].m = cls[m];
+				list[n].alpha = alpha_i[m];
+				n++;
+			}
+	}
+	else
+	{
+		for(m=0;m<k_old;m++)
+			if(m < k || alpha_i[m] != 0)
+			{
+				list[n].m = cls[m];
+				list[n].alpha = alpha_i[m];
+				n++;
+			}
+		for(r=first_inactive;r<nr_ent[i];r++)
+			list[n++] = e[r];
+	}
+	store(i, list, n, k, pool);
+
+	return k > 1;
+}
+
+// Take the lists of the instances from ws, in the caller's work_frame;
+// start_lists() then gives instance i room for nr_ent[i] pairs.
+template <class P> void Solver_MCSVM_CS<P>::take_lists()
+{
+	QD = ws->take<double>(l);
+	ent = ws->take<cs_entry *>(l);
+	nr_ent = ws->take<int>(l);
+	cap = ws->take<int>(l);
+	nr_active = ws->take<int>(l);
+}
+
+template <class P> void Solver_MCSVM_CS<P>::start_lists()
+{
+	size_t total = 0;
+	for(int i=0;i<l;i++)
+		total += nr_ent[i];
+	free(packed);
+	packed = Malloc(cs_entry, max(total, (size_t)1));
+	nr_packed = total;
+	cs_entry *next = packed;
+	for(int i=0;i<l;i++)
+	{
+		ent[i] = next;
+		cap[i] = nr_ent[i];
+		next += nr_ent[i];
+	}
+}
+
+// give back the room of the lists once they are read
+template <class P> void Solver_MCSVM_CS<P>::end_lists()
+{
+	for(size_t k=0;k<pools.size();k++)
+		pools[k].clear();
+	free(packed);
+	packed = NULL;
+	nr_packed = 0;
+}
+
+// If alpha_init is not NULL, Solve() starts from it, made feasible if
+// need be, and leaves the solution in it. Passes run on up to nr_thread
+// threads as described at wild_w.
+template <class P> void Solver_MCSVM_CS<P>::Solve(double *w, double *alpha_init)
+{
+	int i, m, k;
+	work_frame frame(ws);
+	take_lists();
+
+	// sum_m alpha[i*nr_class+m] = 0, for all i=1,...,l-1
+	// alpha[i*nr_class+m] <= C[GETI(i)] if prob->y[i] == m
+	// alpha[i*nr_class+m] <= 0 if prob->y[i] != m
+	if(alpha_init != NULL)
+	{
+		for(i=0;i<l;i++)
+		{
+			double *alpha_i = &alpha_init[(size_t)i*nr_class];
+			int yi = (int)prob->y[i];
+			alpha_i[yi] = 0;
+			for(m=0;m<nr_class;m++)
+				if(m != yi)
 				{
-					if(be_shrunk(i, m, y_index[i], alpha_i[alpha_index_i[m]], minG))
-					{
-						active_size_i[i]--;
-						while(active_size_i[i]>m)
-						{
-							if(!be_shrunk(i, active_size_i[i], y_index[i],
-											alpha_i[alpha_index_i[active_size_i[i]]], minG))
-							{
-								swap(alpha_index_i[m], alpha_index_i[active_size_i[i]]);
-								swap(G[m], G[active_size_i[i]]);
-								if(y_index[i] == active_size_i[i])
-									y_index[i] = m;
-								else if(y_index[i] == m)
-									y_index[i] = active_size_i[i];
-								break;
-							}
-							active_size_i[i]--;
-						}
-					}
+					alpha_i[m] = min(alpha_i[m], 0.0);
+					alpha_i[yi] -= alpha_i[m];
 				}
+			if(alpha_i[yi] > C[GETI(i)])
+			{
+				double scale = C[GETI(i)]/alpha_i[yi];
+				for(m=0;m<nr_class;m++)
+					alpha_i[m] *= scale;
+			}
+		}
+	}
 
-				if(active_size_i[i] <= 1)
+	// the lists start out packed, holding the nonzeros of alpha_init
+	for(i=0;i<l;i++)
+	{
+		nr_ent[i] = 0;
+		if(alpha_init != NULL)
+			for(m=0;m<nr_class;m++)
+				if(alpha_init[(size_t)i*nr_class+m] != 0)
+					nr_ent[i]++;
+	}
+	start_lists();
+	if(alpha_init != NULL)
+		for(i=0;i<l;i++)
+			for(m=0, k=0;m<nr_class;m++)
+				if(alpha_init[(size_t)i*nr_class+m] != 0)
 				{
-					active_size--;
-					swap(index[s], index[active_size]);
-					s--;
-					continue;
+					ent[i][k].m = m;
+					ent[i][k].alpha = alpha_init[(size_t)i*nr_class+m];
+					k++;
 				}
 
-				if(maxG-minG <= 1e-12)
-					continue;
-				else
-					stopping = max(maxG - minG, stopping);
+	solve(w);
 
-				for(m=0;m<active_size_i[i];m++)
-					B[m] = G[m] - Ai*alpha_i[alpha_index_i[m]] ;
+	if(alpha_init != NULL)
+		for(i=0;i<l;i++)
+		{
+			double *alpha_i = &alpha_init[(size_t)i*nr_class];
+			for(m=0;m<nr_class;m++)
+				alpha_i[m] = 0;
+			for(int r=0;r<nr_ent[i];r++)
+				alpha_i[ent[i][r].m] = ent[i][r].alpha;
+		}
+	end_lists();
+}
+
+static int compare_cs_entry(const void *a, const void *b)
+{
+	return ((const cs_entry *)a)->m - ((const cs_entry *)b)->m;
+}
 
-				solve_sub_problem(Ai, y_index[i], C[GETI(i)], active_size_i[i], alpha_new);
-				int nz_d = 0;
-				for(m=0;m<active_size_i[i];m++)
+// The same, but starting from the alphas in duals times scale, if it
+// holds any, and leaving the solution there. Only nonzeros are kept in
+// duals, so a path of C carries the alphas from one C to the next with
+// no l*nr_class array. The results are those of the dense Solve().
+template <class P> void Solver_MCSVM_CS<P>::Solve(double *w, cs_duals *duals, double scale)
+{
+	int i, r;
+	work_frame frame(ws);
+	take_lists();
+
+	// room for the label too, which the alphas made feasible may add
+	for(i=0;i<l;i++)
+		nr_ent[i] = (duals->start != NULL)? (int)(duals->start[i+1]-duals->start[i])+1: 0;
+	start_lists();
+	if(duals->start != NULL)
+		for(i=0;i<l;i++)
+		{
+			// as in the dense Solve(), with the pairs in class order
+			const cs_entry *d = &duals->ent[duals->start[i]];
+			cs_entry *e = ent[i];
+			int n = (int)(duals->start[i+1]-duals->start[i]);
+			int label = (int)prob->y[i];
+			int y_at = n;
+			double alpha_y = 0;
+			for(r=0;r<n;r++)
+			{
+				e[r].m = d[r].m;
+				e[r].alpha = d[r].alpha*scale;
+				if(e[r].m == label)
+					y_at = r;
+				else
 				{
-					double d = alpha_new[m] - alpha_i[alpha_index_i[m]];
-					alpha_i[alpha_index_i[m]] = alpha_new[m];
-					if(fabs(d) >= 1e-12)
-					{
-						d_ind[nz_d] = alpha_index_i[m];
-						d_val[nz_d] = d;
-						nz_d++;
-					}
+					e[r].alpha = min(e[r].alpha, 0.0);
+					alpha_y -= e[r].alpha;
 				}
+			}
+			if(y_at == n)
+			{
+				e[n].m = label;
+				n++;
+			}
+			e[y_at].alpha = alpha_y;
+			if(alpha_y > C[GETI(i)])
+			{
+				double s = C[GETI(i)]/alpha_y;
+				for(r=0;r<n;r++)
+					e[r].alpha *= s;
+			}
+			nr_ent[i] = 0;
+			for(r=0;r<n;r++)
+				if(e[r].alpha != 0)
+					e[nr_ent[i]++] = e[r];
+		}
+
+	solve(w);
+
+	size_t total = 0;
+	for(i=0;i<l;i++)
+		for(r=0;r<nr_ent[i];r++)
+			if(ent[i][r].alpha != 0)
+				total++;
+	free(duals->ent);
+	duals->ent = Malloc(cs_entry, max(total, (size_t)1));
+	if(duals->start == NULL)
+		duals->start = Malloc(size_t, (size_t)l+1);
+	duals->start[0] = 0;
+	for(i=0;i<l;i++)
+	{
+		cs_entry *d = &duals->ent[duals->start[i]];
+		int n = 0;
+		for(r=0;r<nr_ent[i];r++)
+			if(ent[i][r].alpha != 0)
+				d[n++] = ent[i][r];
+		qsort(d, (size_t)n, sizeof(cs_entry), compare_cs_entry);
+		duals->start[i+1] = duals->start[i]+(size_t)n;
+	}
+	end_lists();
+}
 
-				xi = prob->x[i];
-				while(xi->index != -1)
+// CD from the lists as the Solve()s set them up; on return they hold the
+// solution and w = \sum_i alpha_i x_i.
+template <class P> void Solver_MCSVM_CS<P>::solve(double *w)
+{
+	int i, s, k;
+	int iter = 0;
+	int *index = ws->take<int>(l);
+	char *shrunk = (nr_thread > 1)? ws->take<char>(l): NULL;
+	std::vector<cs_scratch> scratch(nr_thread);
+	std::vector<double> stopping_part(nr_thread);
+	int active_size = l;
+	double eps_shrink = max(10.0*eps, 1.0); // stopping tolerance for shrinking
+	bool start_from_all = true;
+	bool wild = false;	// w is to be rebuilt from alpha
+
+	for(k=0;k<nr_thread;k++)
+	{
+		cs_scratch &t = scratch[k];
+		t.G = ws->take<double>(nr_class);
+		t.B = ws->take<double>(nr_class);
+		t.D = ws->take<double>(nr_class);
+		t.alpha = ws->take<double>(nr_class);
+		t.alpha_new = ws->take<double>(nr_class);
+		t.G_class = ws->take<double>(nr_class);
+		t.d_class = ws->take<double>(nr_class);
+		t.d_val = ws->take<double>(nr_class);
+		t.cls = ws->take<int>(nr_class);
+		t.d_ind = ws->take<int>(nr_class);
+		t.list = ws->take<cs_entry>(nr_class);
+	}
+
+	for(size_t j=0;j<(size_t)w_size*nr_class;j++)
+		w[j] = 0;
+	for(i=0;i<l;i++)
+	{
+		QD[i] = 0;
+		for(auto xi=row(prob,i); xi.valid(); xi.next())
+		{
+			double val = xi.value();
+			QD[i] += val*val;
+
+			for(int r=0;r<nr_ent[i];r++)
+				w[(size_t)(xi.index()-1)*nr_class+ent[i][r].m] += ent[i][r].alpha*val;
+		}
+		nr_active[i] = nr_class;
+		index[i] = i;
+	}
+
+	while(iter < max_iter)
+	{
+		double stopping = -INF;
+		for(i=0;i<active_size;i++)
+		{
+			int j = i+solver_rng.uniform(active_size-i);
+			swap(index[i], index[j]);
+		}
+
+		int nr = cd_threads(nr_thread, active_size);
+		if(nr == 1)
+		{
+			for(s=0;s<active_size;s++)
+			{
+				if(!update<serial_w>(index[s], w, scratch[0], pools[0], stopping))
 				{
-					double *w_i = &w[(xi->index-1)*nr_class];
-					for(m=0;m<nz_d;m++)
-						w_i[d_ind[m]] += d_val[m]*xi->value;
-					xi++;
+					active_size--;
+					swap(index[s], index[active_size]);
+					s--;
 				}
 			}
 		}
+		else
+		{
+			wild = true;
+			ws->pool.run(nr, [&](int k) {
+				int first = (int)((long)active_size*k/nr), last = (int)((long)active_size*(k+1)/nr);
+				double stopping_k = -INF;
+				for(int t=first; t<last; t++)
+					shrunk[t] = !this->template update<wild_w>(index[t], w, scratch[k], pools[k], stopping_k);
+				stopping_part[k] = stopping_k;
+			});
+			for(int k=0; k<nr; k++)
+				stopping = max(stopping, stopping_part[k]);
+			active_size = compact_active(index, shrunk, active_size);
+		}
+
+		// lists that moved left their old room behind
+		size_t room = nr_packed, live = 0;
+		for(k=0;k<nr_thread;k++)
+			room += pools[k].used;
+		for(i=0;i<l;i++)
+			live += nr_ent[i];
+		if(room > 2*live+l)
+			pack();
 
 		iter++;
 		if(iter % 10 == 0)
@@ -701,9 +1902,18 @@ void Solver_MCSVM_CS::Solve(double *w)
 				break;
 			else
 			{
+				// all classes active again; only the nonzero alphas stay
 				active_size = l;
 				for(i=0;i<l;i++)
-					active_size_i[i] = nr_class;
+					if(nr_active[i] < nr_class)
+					{
+						int n = 0;
+						for(int r=0;r<nr_ent[i];r++)
+							if(ent[i][r].alpha != 0)
+								ent[i][n++] = ent[i][r];
+						nr_ent[i] = n;
+						nr_active[i] = nr_class;
+					}
 				info("*");
 				eps_shrink = max(eps_shrink/2, eps);
 				start_from_all = true;
@@ -717,32 +1927,36 @@ void Solver_MCSVM_CS::Solve(double *w)
 	if (iter >= max_iter)
 		info("\nWARNING: reaching max number of iterations\n");
 
+	// updates lost between threads leave w off \sum_i alpha_i x_i
+	if(wild)
+	{
+		for(size_t j=0;j<(size_t)w_size*nr_class;j++)
+			w[j] = 0;
+		for(i=0;i<l;i++)
+			for(auto xi=row(prob,i); xi.valid(); xi.next())
+				for(int r=0;r<nr_ent[i];r++)
+					w[(size_t)(xi.index()-1)*nr_class+ent[i][r].m] += ent[i][r].alpha*xi.value();
+	}
+
 	// calculate objective value
 	double v = 0;
 	int nSV = 0;
-	for(i=0;i<w_size*nr_class;i++)
-		v += w[i]*w[i];
+	for(size_t j=0;j<(size_t)w_size*nr_class;j++)
+		v += w[j]*w[j];
 	v = 0.5*v;
-	for(i=0;i<l*nr_class;i++)
-	{
-		v += alpha[i];
-		if(fabs(alpha[i]) > 0)
-			nSV++;
-	}
 	for(i=0;i<l;i++)
-		v -= alpha[i*nr_class+(int)prob->y[i]];
+		for(int r=0;r<nr_ent[i];r++)
+		{
+			v += ent[i][r].alpha;
+			if(fabs(ent[i][r].alpha) > 0)
+				nSV++;
+		}
+	for(i=0;i<l;i++)
+		for(int r=0;r<nr_ent[i];r++)
+			if(ent[i][r].m == (int)prob->y[i])
+				v -= ent[i][r].alpha;
 	info("Objective value = %lf\n",v);
 	info("nSV = %d\n",nSV);
-
-	delete [] alpha;
-	delete [] alpha_new;
-	delete [] index;
-	delete [] QD;
-	delete [] d_ind;
-	delete [] d_val;
-	delete [] alpha_index;
-	delete [] y_index;
-	delete [] active_size_i;
 }
 
 // A coordinate descent algorithm for 
@@ -775,170 +1989,276 @@ void Solver_MCSVM_CS::Solve(double *w)
 #define GETI(i) (y[i]+1)
 // To support weights for instances, use GETI(i) (i)
 
-static void solve_l2r_l1l2_svc(
-	const problem *prob, double *w, double eps,
-	double Cp, double Cn, int solver_type)
+// The bounds of the projected gradients of a pass of dual CD
+struct pg_range
 {
-	int l = prob->l;
-	int w_size = prob->n;
-	int i, s, iter = 0;
-	double C, d, G;
-	double *QD = new double[l];
-	int max_iter = 1000;
-	int *index = new int[l];
-	double *alpha = new double[l];
-	schar *y = new schar[l];
-	int active_size = l;
+	double max, min;
+};
 
+// One step of dual CD on alpha[i]. Returns false, leaving alpha[i]
+// alone, if i is to be shrunk; else widens PG_new by its projected
+// gradient.
+template <class W, class P> static inline bool svc_cd_step(
+	const P *prob, int i, const schar *y, double *w, double *alpha,
+	const double *QD, const double *diag, const double *upper_bound,
+	const pg_range &PG_old, pg_range &PG_new)
+{
+	double C, d, G;
 	// PG: projected gradient, for shrinking and stopping
 	double PG;
-	double PGmax_old = INF;
-	double PGmin_old = -INF;
-	double PGmax_new, PGmin_new;
 
-	// default solver_type: L2R_L2LOSS_SVC_DUAL
-	double diag[3] = {0.5/Cn, 0, 0.5/Cp};
-	double upper_bound[3] = {INF, 0, INF};
-	if(solver_type == L2R_L1LOSS_SVC_DUAL)
+	G = 0;
+	schar yi = y[i];
+
+	for(auto xi=row(prob,i); xi.valid(); xi.next())
 	{
-		diag[0] = 0;
-		diag[2] = 0;
-		upper_bound[0] = Cn;
-		upper_bound[2] = Cp;
+		G += W::get(w, xi.index()-1)*(xi.value());
 	}
+	G = G*yi-1;
 
-	for(i=0; i<l; i++)
+	C = upper_bound[GETI(i)];
+	G += alpha[i]*diag[GETI(i)];
+
+	PG = 0;
+	if (alpha[i] == 0)
 	{
-		if(prob->y[i] > 0)
+		if (G > PG_old.max)
+			return false;
+		else if (G < 0)
+			PG = G;
+	}
+	else if (alpha[i] == C)
+	{
+		if (G < PG_old.min)
+			return false;
+		else if (G > 0)
+			PG = G;
+	}
+	else
+		PG = G;
+
+	PG_new.max = max(PG_new.max, PG);
+	PG_new.min = min(PG_new.min, PG);
+
+	if(fabs(PG) > 1.0e-12)
+	{
+		double alpha_old = alpha[i];
+		alpha[i] = min(max(alpha[i] - G/QD[i], 0.0), C);
+		d = (alpha[i] - alpha_old)*yi;
+		for(auto xi=row(prob,i); xi.valid(); xi.next())
 		{
-			y[i] = +1;
+			W::add(w, xi.index()-1, d*xi.value());
 		}
-		else
+	}
+	return true;
+}
+
+// One pass of dual CD over index[0], ..., index[active_size-1] on nr
+// threads of pool, as described at wild_w. Widens PG_new by the projected
+// gradients, shrinks the active set and returns its new size.
+template <class P> static int svc_cd_pass(
+	const P *prob, thread_pool *pool, int nr, int *index, int active_size, char *shrunk,
+	const schar *y, double *w, double *alpha, const double *QD,
+	const double *diag, const double *upper_bound,
+	const pg_range &PG_old, pg_range &PG_new, pg_range *PG_part)
+{
+	if(nr == 1)
+	{
+		for (int s=0; s<active_size; s++)
 		{
-			y[i] = -1;
+			if(!svc_cd_step<serial_w>(prob, index[s], y, w, alpha, QD, diag, upper_bound, PG_old, PG_new))
+			{
+				active_size--;
+				swap(index[s], index[active_size]);
+				s--;
+			}
 		}
+		return active_size;
+	}
+	pool->run(nr, [&](int k) {
+		int first = (int)((long)active_size*k/nr), last = (int)((long)active_size*(k+1)/nr);
+		pg_range PG_k = {-INF, INF};
+		for(int t=first; t<last; t++)
+			shrunk[t] = !svc_cd_step<wild_w>(prob, index[t], y, w, alpha, QD, diag, upper_bound, PG_old, PG_k);
+		PG_part[k] = PG_k;
+	});
+	for(int k=0; k<nr; k++)
+	{
+		PG_new.max = max(PG_new.max, PG_part[k].max);
+		PG_new.min = min(PG_new.min, PG_part[k].min);
 	}
+	return compact_active(index, shrunk, active_size);
+}
 
-	// Initial alpha can be set here. Note that
-	// 0 <= alpha[i] <= upper_bound[GETI(i)]
-	for(i=0; i<l; i++)
-		alpha[i] = 0;
+// Dual CD passes over the instances of prob, starting from alpha, for
+// which w = \sum_i y_i alpha_i x_i must already hold. Stops when the
+// maximal violation is <= eps or after max_iter passes and returns the
+// number of passes. If PG_first is not NULL, the maximal and minimal
+// projected gradients of the first pass, i.e. at the starting point, are
+// stored in PG_first[0] and PG_first[1]. Passes run on up to nr_thread
+// threads as described at wild_w, in the order described at cd_order,
+// and read the active rows from a copy once enough instances are shrunk,
+// as described at active_rows.
+template <class P> static int solve_l2r_l1l2_svc_cd(
+	const P *prob, const schar *y, double *w, double *alpha,
+	double eps, const double *diag, const double *upper_bound,
+	int max_iter, double *PG_first, int nr_thread, int shuffle_block, workspace *ws)
+{
+	typedef typename value_of<P>::type V;
+	work_frame frame(ws);
+	int l = prob->l;
+	int i, s, iter = 0;
+	double *QD = ws->take<double>(l);
+	int *index = ws->take<int>(l);
+	int *nnz = ws->take<int>(l);
+	char *shrunk = (nr_thread > 1)? ws->take<char>(l): NULL;
+	std::vector<pg_range> PG_part(nr_thread);
+	wild_snapshot snap(prob->n, l, nr_thread, ws);
+	cd_order order(l, shuffle_block, ws);
+	int active_size = l;
+	long total = 0;
+
+	pg_range PG_old = {INF, -INF};
+	pg_range PG_new;
 
-	for(i=0; i<w_size; i++)
-		w[i] = 0;
 	for(i=0; i<l; i++)
 	{
 		QD[i] = diag[GETI(i)];
+		nnz[i] = 0;
 
-		feature_node *xi = prob->x[i];
-		while (xi->index != -1)
+		for(auto xi=row(prob,i); xi.valid(); xi.next())
 		{
-			double val = xi->value;
+			double val = xi.value();
 			QD[i] += val*val;
-			w[xi->index-1] += y[i]*alpha[i]*val;
-			xi++;
+			nnz[i]++;
 		}
 		index[i] = i;
+		total += nnz[i];
 	}
 
+	active_rows<V> rows(total, ws);
+	const csr_view<V> *active = NULL;	// the copy of the active rows, if any
+
 	while (iter < max_iter)
 	{
-		PGmax_new = -INF;
-		PGmin_new = INF;
-
-		for (i=0; i<active_size; i++)
-		{
-			int j = i+rand()%(active_size-i);
-			swap(index[i], index[j]);
-		}
-
-		for (s=0; s<active_size; s++)
-		{
-			i = index[s];
-			G = 0;
-			schar yi = y[i];
-
-			feature_node *xi = prob->x[i];
-			while(xi->index!= -1)
-			{
-				G += w[xi->index-1]*(xi->value);
-				xi++;
-			}
-			G = G*yi-1;
+		PG_new.max = -INF;
+		PG_new.min = INF;
 
-			C = upper_bound[GETI(i)];
-			G += alpha[i]*diag[GETI(i)];
-
-			PG = 0;
-			if (alpha[i] == 0)
-			{
-				if (G > PGmax_old)
-				{
-					active_size--;
-					swap(index[s], index[active_size]);
-					s--;
-					continue;
-				}
-				else if (G < 0)
-					PG = G;
-			}
-			else if (alpha[i] == C)
-			{
-				if (G < PGmin_old)
-				{
-					active_size--;
-					swap(index[s], index[active_size]);
-					s--;
-					continue;
-				}
-				else if (G > 0)
-					PG = G;
-			}
-			else
-				PG = G;
+		order.shuffle(index, active_size);
 
-			PGmax_new = max(PGmax_new, PG);
-			PGmin_new = min(PGmin_new, PG);
+		int nr = cd_threads(nr_thread, active_size);
+		if(nr > 1)
+			snap.take(w, alpha, 1);
+		if(active != NULL)
+			active_size = svc_cd_pass(active, &ws->pool, nr, index, active_size, shrunk, y, w, alpha, QD, diag, upper_bound, PG_old, PG_new, &PG_part[0]);
+		else
+			active_size = svc_cd_pass(prob, &ws->pool, nr, index, active_size, shrunk, y, w, alpha, QD, diag, upper_bound, PG_old, PG_new, &PG_part[0]);
 
-			if(fabs(PG) > 1.0e-12)
+		// block minimization reports its progress per sweep instead
+		if(PG_first != NULL)
+		{
+			if(iter == 0)
 			{
-				double alpha_old = alpha[i];
-				alpha[i] = min(max(alpha[i] - G/QD[i], 0.0), C);
-				d = (alpha[i] - alpha_old)*yi;
-				xi = prob->x[i];
-				while (xi->index != -1)
-				{
-					w[xi->index-1] += d*xi->value;
-					xi++;
-				}
+				PG_first[0] = PG_new.max;
+				PG_first[1] = PG_new.min;
 			}
 		}
-
-		iter++;
-		if(iter % 10 == 0)
+		else if((iter+1) % 10 == 0)
 			info(".");
+		iter++;
 
-		if(PGmax_new - PGmin_new <= eps)
+		if(PG_new.max - PG_new.min <= eps)
 		{
 			if(active_size == l)
 				break;
 			else
 			{
 				active_size = l;
-				info("*");
-				PGmax_old = INF;
-				PGmin_old = -INF;
+				active = NULL;
+				rows.reset();
+				if(PG_first == NULL)
+					info("*");
+				PG_old.max = INF;
+				PG_old.min = -INF;
 				continue;
 			}
 		}
-		PGmax_old = PGmax_new;
-		PGmin_old = PGmin_new;
-		if (PGmax_old <= 0)
-			PGmax_old = INF;
-		if (PGmin_old >= 0)
-			PGmin_old = -INF;
+		PG_old = PG_new;
+		if (PG_old.max <= 0)
+			PG_old.max = INF;
+		if (PG_old.min >= 0)
+			PG_old.min = -INF;
+
+		long active_nnz = 0;
+		for(s=0; s<active_size; s++)
+			active_nnz += nnz[index[s]];
+		if(rows.worth(active_nnz))
+		{
+			if(active != NULL)
+				active = rows.fill(active, index, active_size, active_nnz);
+			else
+				active = rows.fill(prob, index, active_size, active_nnz);
+		}
+	}
+
+	snap.rebuild(prob, y, w, alpha, 1);
+
+	return iter;
+}
+
+// If alpha_init is not NULL, the solver starts from it, moved into the
+// bounds if need be, and leaves the solution in it.
+template <class P> static void solve_l2r_l1l2_svc(
+	const P *prob, double *w, double *alpha_init, double eps,
+	double Cp, double Cn, int solver_type, int nr_thread, int shuffle_block, workspace *ws)
+{
+	work_frame frame(ws);
+	int l = prob->l;
+	int w_size = prob->n;
+	int i, iter;
+	int max_iter = 1000;
+	double *alpha = (alpha_init != NULL)? alpha_init: ws->take<double>(l);
+	schar *y = ws->take<schar>(l);
+
+	// default solver_type: L2R_L2LOSS_SVC_DUAL
+	double diag[3] = {0.5/Cn, 0, 0.5/Cp};
+	double upper_bound[3] = {INF, 0, INF};
+	if(solver_type == L2R_L1LOSS_SVC_DUAL)
+	{
+		diag[0] = 0;
+		diag[2] = 0;
+		upper_bound[0] = Cn;
+		upper_bound[2] = Cp;
+	}
+
+	for(i=0; i<l; i++)
+	{
+		if(prob->y[i] > 0)
+		{
+			y[i] = +1;
+		}
+		else
+		{
+			y[i] = -1;
+		}
+	}
+
+	// 0 <= alpha[i] <= upper_bound[GETI(i)]
+	for(i=0; i<l; i++)
+		alpha[i] = (alpha_init != NULL)? min(max(alpha[i], 0.0), upper_bound[GETI(i)]): 0;
+
+	for(i=0; i<w_size; i++)
+		w[i] = 0;
+	for(i=0; i<l; i++)
+	{
+		for(auto xi=row(prob,i); xi.valid(); xi.next())
+		{
+			w[xi.index()-1] += y[i]*alpha[i]*xi.value();
+		}
 	}
 
+	iter = solve_l2r_l1l2_svc_cd(prob, y, w, alpha, eps, diag, upper_bound, max_iter, NULL, get_nr_thread(nr_thread), shuffle_block, ws);
+
 	info("\noptimization finished, #iter = %d\n",iter);
 	if (iter >= max_iter)
 		info("\nWARNING: reaching max number of iterations\nUsing -s 2 may be faster (also see FAQ)\n\n");
@@ -958,10 +2278,6 @@ static void solve_l2r_l1l2_svc(
 	info("Objective value = %lf\n",v/2);
 	info("nSV = %d\n",nSV);
 
-	delete [] QD;
-	delete [] alpha;
-	delete [] y;
-	delete [] index;
 }
 
 
@@ -993,10 +2309,97 @@ static void solve_l2r_l1l2_svc(
 #define GETI(i) (0)
 // To support weights for instances, use GETI(i) (i)
 
-static void solve_l2r_l1l2_svr(
-	const problem *prob, double *w, const parameter *param,
-	int solver_type)
+// The largest violation and the sum of the violations of a pass
+struct violation_sum
+{
+	double max, sum;
+};
+
+// One step of CD on beta[i], as svc_cd_step()
+template <class W, class P> static inline bool svr_cd_step(
+	const P *prob, int i, const double *y, double *w, double *beta,
+	const double *QD, const double *lambda, const double *upper_bound, double p,
+	double Gmax_old, violation_sum &V_new)
+{
+	double d, G, H;
+
+	G = -y[i] + lambda[GETI(i)]*beta[i];
+	H = QD[i] + lambda[GETI(i)];
+
+	for(auto xi=row(prob,i); xi.valid(); xi.next())
+	{
+		int ind = xi.index()-1;
+		double val = xi.value();
+		G += val*W::get(w, ind);
+	}
+
+	double Gp = G+p;
+	double Gn = G-p;
+	double violation = 0;
+	if(beta[i] == 0)
+	{
+		if(Gp < 0)
+			violation = -Gp;
+		else if(Gn > 0)
+			violation = Gn;
+		else if(Gp>Gmax_old && Gn<-Gmax_old)
+			return false;
+	}
+	else if(beta[i] >= upper_bound[GETI(i)])
+	{
+		if(Gp > 0)
+			violation = Gp;
+		else if(Gp < -Gmax_old)
+			return false;
+	}
+	else if(beta[i] <= -upper_bound[GETI(i)])
+	{
+		if(Gn < 0)
+			violation = -Gn;
+		else if(Gn > Gmax_old)
+			return false;
+	}
+	else if(beta[i] > 0)
+		violation = fabs(Gp);
+	else
+		violation = fabs(Gn);
+
+	V_new.max = max(V_new.max, violation);
+	V_new.sum += violation;
+
+	// obtain Newton direction d
+	if(Gp < H*beta[i])
+		d = -Gp/H;
+	else if(Gn > H*beta[i])
+		d = -Gn/H;
+	else
+		d = -beta[i];
+
+	if(fabs(d) < 1.0e-12)
+		return true;
+
+	double beta_old = beta[i];
+	beta[i] = min(max(beta[i]+d, -upper_bound[GETI(i)]), upper_bound[GETI(i)]);
+	d = beta[i]-beta_old;
+
+	if(d != 0)
+	{
+		for(auto xi=row(prob,i); xi.valid(); xi.next())
+		{
+			W::add(w, xi.index()-1, d*xi.value());
+		}
+	}
+	return true;
+}
+
+// beta_init is used as alpha_init of solve_l2r_l1l2_svc(). Passes run on
+// up to param->nr_thread threads as described at wild_w, in the order
+// described at cd_order.
+template <class P> static void solve_l2r_l1l2_svr(
+	const P *prob, double *w, double *beta_init, const parameter *param,
+	int solver_type, workspace *ws)
 {
+	work_frame frame(ws);
 	int l = prob->l;
 	double C = param->C;
 	double p = param->p;
@@ -1005,14 +2408,19 @@ static void solve_l2r_l1l2_svr(
 	int i, s, iter = 0;
 	int max_iter = 1000;
 	int active_size = l;
-	int *index = new int[l];
+	int *index = ws->take<int>(l);
+	int nr_thread = get_nr_thread(param->nr_thread);
+	char *shrunk = (nr_thread > 1)? ws->take<char>(l): NULL;
+	std::vector<violation_sum> V_part(nr_thread);
+	wild_snapshot snap(w_size, l, nr_thread, ws);
+	cd_order order(l, param->shuffle_block, ws);
 
-	double d, G, H;
 	double Gmax_old = INF;
-	double Gmax_new, Gnorm1_new;
-	double Gnorm1_init;
-	double *beta = new double[l];
-	double *QD = new double[l];
+	violation_sum V_new;
+	double Gnorm1_init = -1; // set at the first iteration unless beta starts nonzero
+	bool warm = false;
+	double *beta = (beta_init != NULL)? beta_init: ws->take<double>(l);
+	double *QD = ws->take<double>(l);
 	double *y = prob->y;
 
 	// L2R_L2LOSS_SVR_DUAL
@@ -1026,137 +2434,82 @@ static void solve_l2r_l1l2_svr(
 		upper_bound[0] = C;
 	}
 
-	// Initial beta can be set here. Note that
 	// -upper_bound <= beta[i] <= upper_bound
 	for(i=0; i<l; i++)
-		beta[i] = 0;
-
-	for(i=0; i<w_size; i++)
-		w[i] = 0;
-	for(i=0; i<l; i++)
-	{
-		QD[i] = 0;
-		feature_node *xi = prob->x[i];
-		while(xi->index != -1)
-		{
-			double val = xi->value;
-			QD[i] += val*val;
-			w[xi->index-1] += beta[i]*val;
-			xi++;
-		}
-
-		index[i] = i;
-	}
-
-
-	while(iter < max_iter)
-	{
-		Gmax_new = 0;
-		Gnorm1_new = 0;
-
-		for(i=0; i<active_size; i++)
-		{
-			int j = i+rand()%(active_size-i);
-			swap(index[i], index[j]);
-		}
-
-		for(s=0; s<active_size; s++)
-		{
-			i = index[s];
-			G = -y[i] + lambda[GETI(i)]*beta[i];
-			H = QD[i] + lambda[GETI(i)];
-
-			feature_node *xi = prob->x[i];
-			while(xi->index != -1)
-			{
-				int ind = xi->index-1;
-				double val = xi->value;
-				G += val*w[ind];
-				xi++;
-			}
-
-			double Gp = G+p;
-			double Gn = G-p;
-			double violation = 0;
-			if(beta[i] == 0)
-			{
-				if(Gp < 0)
-					violation = -Gp;
-				else if(Gn > 0)
-					violation = Gn;
-				else if(Gp>Gmax_old && Gn<-Gmax_old)
-				{
-					active_size--;
-					swap(index[s], index[active_size]);
-					s--;
-					continue;
-				}
-			}
-			else if(beta[i] >= upper_bound[GETI(i)])
-			{
-				if(Gp > 0)
-					violation = Gp;
-				else if(Gp < -Gmax_old)
-				{
-					active_size--;
-					swap(index[s], index[active_size]);
-					s--;
-					continue;
-				}
-			}
-			else if(beta[i] <= -upper_bound[GETI(i)])
-			{
-				if(Gn < 0)
-					violation = -Gn;
-				else if(Gn > Gmax_old)
-				{
-					active_size--;
-					swap(index[s], index[active_size]);
-					s--;
-					continue;
-				}
-			}
-			else if(beta[i] > 0)
-				violation = fabs(Gp);
-			else
-				violation = fabs(Gn);
+		beta[i] = (beta_init != NULL)? min(max(beta[i], -upper_bound[GETI(i)]), upper_bound[GETI(i)]): 0;
 
-			Gmax_new = max(Gmax_new, violation);
-			Gnorm1_new += violation;
+	// a warm start is measured against the violation at beta = 0
+	for(i=0; i<l; i++)
+		if(beta[i] != 0)
+			warm = true;
+	if(warm)
+	{
+		Gnorm1_init = 0;
+		for(i=0; i<l; i++)
+			Gnorm1_init += max(fabs(y[i])-p, 0.0);
+	}
 
-			// obtain Newton direction d
-			if(Gp < H*beta[i])
-				d = -Gp/H;
-			else if(Gn > H*beta[i])
-				d = -Gn/H;
-			else
-				d = -beta[i];
+	for(i=0; i<w_size; i++)
+		w[i] = 0;
+	for(i=0; i<l; i++)
+	{
+		QD[i] = 0;
+		for(auto xi=row(prob,i); xi.valid(); xi.next())
+		{
+			double val = xi.value();
+			QD[i] += val*val;
+			w[xi.index()-1] += beta[i]*val;
+		}
 
-			if(fabs(d) < 1.0e-12)
-				continue;
+		index[i] = i;
+	}
 
-			double beta_old = beta[i];
-			beta[i] = min(max(beta[i]+d, -upper_bound[GETI(i)]), upper_bound[GETI(i)]);
-			d = beta[i]-beta_old;
 
-			if(d != 0)
+	while(iter < max_iter)
+	{
+		V_new.max = 0;
+		V_new.sum = 0;
+
+		order.shuffle(index, active_size);
+
+		int nr = cd_threads(nr_thread, active_size);
+		if(nr == 1)
+		{
+			for(s=0; s<active_size; s++)
 			{
-				xi = prob->x[i];
-				while(xi->index != -1)
+				if(!svr_cd_step<serial_w>(prob, index[s], y, w, beta, QD, lambda, upper_bound, p, Gmax_old, V_new))
 				{
-					w[xi->index-1] += d*xi->value;
-					xi++;
+					active_size--;
+					swap(index[s], index[active_size]);
+					s--;
 				}
 			}
 		}
+		else
+		{
+			snap.take(w, beta, 1);
+			ws->pool.run(nr, [&](int k) {
+				int first = (int)((long)active_size*k/nr), last = (int)((long)active_size*(k+1)/nr);
+				violation_sum V_k = {0, 0};
+				for(int t=first; t<last; t++)
+					shrunk[t] = !svr_cd_step<wild_w>(prob, index[t], y, w, beta, QD, lambda, upper_bound, p, Gmax_old, V_k);
+				V_part[k] = V_k;
+			});
+			for(int k=0; k<nr; k++)
+			{
+				V_new.max = max(V_new.max, V_part[k].max);
+				V_new.sum += V_part[k].sum;
+			}
+			active_size = compact_active(index, shrunk, active_size);
+		}
 
-		if(iter == 0)
-			Gnorm1_init = Gnorm1_new;
+		if(iter == 0 && !warm)
+			Gnorm1_init = V_new.sum;
 		iter++;
 		if(iter % 10 == 0)
 			info(".");
 
-		if(Gnorm1_new <= eps*Gnorm1_init)
+		if(V_new.sum <= eps*Gnorm1_init)
 		{
 			if(active_size == l)
 				break;
@@ -1169,8 +2522,9 @@ static void solve_l2r_l1l2_svr(
 			}
 		}
 
-		Gmax_old = Gmax_new;
+		Gmax_old = V_new.max;
 	}
+	snap.rebuild(prob, (const schar *)NULL, w, beta, 1);
 
 	info("\noptimization finished, #iter = %d\n", iter);
 	if(iter >= max_iter)
@@ -1192,9 +2546,6 @@ static void solve_l2r_l1l2_svr(
 	info("Objective value = %lf\n", v);
 	info("nSV = %d\n",nSV);
 
-	delete [] beta;
-	delete [] QD;
-	delete [] index;
 }
 
 
@@ -1220,19 +2571,169 @@ static void solve_l2r_l1l2_svr(
 #define GETI(i) (y[i]+1)
 // To support weights for instances, use GETI(i) (i)
 
-void solve_l2r_lr_dual(const problem *prob, double *w, double eps, double Cp, double Cn)
+// One step of dual CD on alpha[2*i] and alpha[2*i+1]: widens Gmax by
+// the gradient there and adds the inner Newton steps to newton_iter
+template <class W, class P> static inline void lr_dual_cd_step(
+	const P *prob, int i, const schar *y, double *w, double *alpha,
+	const double *xTx, const double *upper_bound, double innereps,
+	double &Gmax, int &newton_iter)
+{
+	int max_inner_iter = 100; // for inner Newton
+	schar yi = y[i];
+	double C = upper_bound[GETI(i)];
+	double ywTx = 0, xisq = xTx[i];
+	for(auto xi=row(prob,i); xi.valid(); xi.next())
+	{
+		ywTx += W::get(w, xi.index()-1)*xi.value();
+	}
+	ywTx *= y[i];
+	double a = xisq, b = ywTx;
+
+	// Decide to minimize g_1(z) or g_2(z)
+	int ind1 = 2*i, ind2 = 2*i+1, sign = 1;
+	if(0.5*a*(alpha[ind2]-alpha[ind1])+b < 0)
+	{
+		ind1 = 2*i+1;
+		ind2 = 2*i;
+		sign = -1;
+	}
+
+	//  g_t(z) = z*log(z) + (C-z)*log(C-z) + 0.5a(z-alpha_old)^2 + sign*b(z-alpha_old)
+	double alpha_old = alpha[ind1];
+	double z = alpha_old;
+	if(C - z < 0.5 * C)
+		z = 0.1*z;
+	double gp = a*(z-alpha_old)+sign*b+log(z/(C-z));
+	Gmax = max(Gmax, fabs(gp));
+
+	// Newton method on the sub-problem
+	const double eta = 0.1; // xi in the paper
+	int inner_iter = 0;
+	while (inner_iter <= max_inner_iter)
+	{
+		if(fabs(gp) < innereps)
+			break;
+		double gpp = a + C/(C-z)/z;
+		double tmpz = z - gp/gpp;
+		if(tmpz <= 0)
+			z *= eta;
+		else // tmpz in (0, C)
+			z = tmpz;
+		gp = a*(z-alpha_old)+sign*b+log(z/(C-z));
+		newton_iter++;
+		inner_iter++;
+	}
+
+	if(inner_iter > 0) // update w
+	{
+		alpha[ind1] = z;
+		alpha[ind2] = C-z;
+		for(auto xi=row(prob,i); xi.valid(); xi.next())
+		{
+			W::add(w, xi.index()-1, sign*(z-alpha_old)*yi*xi.value());
+		}
+	}
+}
+
+// Dual CD passes over the instances of prob, starting from alpha, for
+// which w = \sum_i y_i alpha[2*i] x_i must already hold. innereps, the
+// tolerance of the inner Newton steps, is carried over between calls.
+// Stops when the maximal gradient is < eps or after max_iter passes and
+// returns the number of passes; if Gmax_first is not NULL, the maximal
+// gradient of the first pass is stored there. Passes run on up to
+// nr_thread threads as described at wild_w, in the order described at
+// cd_order.
+template <class P> static int solve_l2r_lr_dual_cd(
+	const P *prob, const schar *y, double *w, double *alpha,
+	double eps, const double *upper_bound, int max_iter,
+	double *innereps, double *Gmax_first, int nr_thread, int shuffle_block, workspace *ws)
 {
+	work_frame frame(ws);
 	int l = prob->l;
-	int w_size = prob->n;
 	int i, s, iter = 0;
-	double *xTx = new double[l];
+	double *xTx = ws->take<double>(l);
+	int *index = ws->take<int>(l);
+	std::vector<double> Gmax_part(nr_thread);
+	std::vector<int> newton_part(nr_thread);
+	wild_snapshot snap(prob->n, l, nr_thread, ws);
+	cd_order order(l, shuffle_block, ws);
+	double innereps_min = min(1e-8, eps);
+
+	for(i=0; i<l; i++)
+	{
+		xTx[i] = 0;
+		for(auto xi=row(prob,i); xi.valid(); xi.next())
+		{
+			double val = xi.value();
+			xTx[i] += val*val;
+		}
+		index[i] = i;
+	}
+
+	while (iter < max_iter)
+	{
+		order.shuffle(index, l);
+		int newton_iter = 0;
+		double Gmax = 0;
+		int nr = cd_threads(nr_thread, l);
+		if(nr == 1)
+		{
+			for (s=0; s<l; s++)
+				lr_dual_cd_step<serial_w>(prob, index[s], y, w, alpha, xTx, upper_bound, *innereps, Gmax, newton_iter);
+		}
+		else
+		{
+			snap.take(w, alpha, 2);
+			ws->pool.run(nr, [&](int k) {
+				int first = (int)((long)l*k/nr), last = (int)((long)l*(k+1)/nr);
+				double Gmax_k = 0;
+				int newton_k = 0;
+				for(int t=first; t<last; t++)
+					lr_dual_cd_step<wild_w>(prob, index[t], y, w, alpha, xTx, upper_bound, *innereps, Gmax_k, newton_k);
+				Gmax_part[k] = Gmax_k;
+				newton_part[k] = newton_k;
+			});
+			for(int k=0; k<nr; k++)
+			{
+				Gmax = max(Gmax, Gmax_part[k]);
+				newton_iter += newton_part[k];
+			}
+		}
+
+		// block minimization reports its progress per sweep instead
+		if(Gmax_first != NULL)
+		{
+			if(iter == 0)
+				*Gmax_first = Gmax;
+		}
+		else if((iter+1) % 10 == 0)
+			info(".");
+		iter++;
+
+		if(Gmax < eps)
+			break;
+
+		if(newton_iter <= l/10)
+			*innereps = max(innereps_min, 0.1*(*innereps));
+
+	}
+	snap.rebuild(prob, y, w, alpha, 2);
+
+	return iter;
+}
+
+// alpha_init, if not NULL, holds alpha[2*i] of each instance, as the
+// alpha_init of solve_l2r_l1l2_svc()
+template <class P> static void solve_l2r_lr_dual(const P *prob, double *w, double *alpha_init, double eps, double Cp, double Cn, int nr_thread, int shuffle_block, workspace *ws)
+{
+	work_frame frame(ws);
+	int l = prob->l;
+	int w_size = prob->n;
+	int i, iter;
 	int max_iter = 1000;
-	int *index = new int[l];	
-	double *alpha = new double[2*l]; // store alpha and C - alpha
-	schar *y = new schar[l];
-	int max_inner_iter = 100; // for inner Newton
+	double *alpha = ws->take<double>(2*l); // store alpha and C - alpha
+	schar *y = ws->take<schar>(l);
 	double innereps = 1e-2;
-	double innereps_min = min(1e-8, eps);
 	double upper_bound[3] = {Cn, 0, Cp};
 
 	for(i=0; i<l; i++)
@@ -1247,12 +2748,15 @@ void solve_l2r_lr_dual(const problem *prob, double *w, double eps, double Cp, do
 		}
 	}
 	
-	// Initial alpha can be set here. Note that
 	// 0 < alpha[i] < upper_bound[GETI(i)]
 	// alpha[2*i] + alpha[2*i+1] = upper_bound[GETI(i)]
 	for(i=0; i<l; i++)
 	{
-		alpha[2*i] = min(0.001*upper_bound[GETI(i)], 1e-8);
+		double a0 = min(0.001*upper_bound[GETI(i)], 1e-8);
+		if(alpha_init != NULL)
+			alpha[2*i] = min(max(alpha_init[i], a0), upper_bound[GETI(i)] - a0);
+		else
+			alpha[2*i] = a0;
 		alpha[2*i+1] = upper_bound[GETI(i)] - alpha[2*i];
 	}
 
@@ -1260,101 +2764,16 @@ void solve_l2r_lr_dual(const problem *prob, double *w, double eps, double Cp, do
 		w[i] = 0;
 	for(i=0; i<l; i++)
 	{
-		xTx[i] = 0;
-		feature_node *xi = prob->x[i];
-		while (xi->index != -1)
+		for(auto xi=row(prob,i); xi.valid(); xi.next())
 		{
-			double val = xi->value;
-			xTx[i] += val*val;
-			w[xi->index-1] += y[i]*alpha[2*i]*val;
-			xi++;
+			w[xi.index()-1] += y[i]*alpha[2*i]*xi.value();
 		}
-		index[i] = i;
 	}
 
-	while (iter < max_iter)
-	{
-		for (i=0; i<l; i++)
-		{
-			int j = i+rand()%(l-i);
-			swap(index[i], index[j]);
-		}
-		int newton_iter = 0;
-		double Gmax = 0;
-		for (s=0; s<l; s++)
-		{
-			i = index[s];
-			schar yi = y[i];
-			double C = upper_bound[GETI(i)];
-			double ywTx = 0, xisq = xTx[i];
-			feature_node *xi = prob->x[i];
-			while (xi->index != -1)
-			{
-				ywTx += w[xi->index-1]*xi->value;
-				xi++;
-			}
-			ywTx *= y[i];
-			double a = xisq, b = ywTx;
-
-			// Decide to minimize g_1(z) or g_2(z)
-			int ind1 = 2*i, ind2 = 2*i+1, sign = 1;
-			if(0.5*a*(alpha[ind2]-alpha[ind1])+b < 0)
-			{
-				ind1 = 2*i+1;
-				ind2 = 2*i;
-				sign = -1;
-			}
-
-			//  g_t(z) = z*log(z) + (C-z)*log(C-z) + 0.5a(z-alpha_old)^2 + sign*b(z-alpha_old)
-			double alpha_old = alpha[ind1];
-			double z = alpha_old;
-			if(C - z < 0.5 * C)
-				z = 0.1*z;
-			double gp = a*(z-alpha_old)+sign*b+log(z/(C-z));
-			Gmax = max(Gmax, fabs(gp));
-
-			// Newton method on the sub-problem
-			const double eta = 0.1; // xi in the paper
-			int inner_iter = 0;
-			while (inner_iter <= max_inner_iter)
-			{
-				if(fabs(gp) < innereps)
-					break;
-				double gpp = a + C/(C-z)/z;
-				double tmpz = z - gp/gpp;
-				if(tmpz <= 0)
-					z *= eta;
-				else // tmpz in (0, C)
-					z = tmpz;
-				gp = a*(z-alpha_old)+sign*b+log(z/(C-z));
-				newton_iter++;
-				inner_iter++;
-			}
-
-			if(inner_iter > 0) // update w
-			{
-				alpha[ind1] = z;
-				alpha[ind2] = C-z;
-				xi = prob->x[i];
-				while (xi->index != -1)
-				{
-					w[xi->index-1] += sign*(z-alpha_old)*yi*xi->value;
-					xi++;
-				}
-			}
-		}
-
-		iter++;
-		if(iter % 10 == 0)
-			info(".");
-
-		if(Gmax < eps)
-			break;
-
-		if(newton_iter <= l/10)
-			innereps = max(innereps_min, 0.1*innereps);
-
-	}
+	iter = solve_l2r_lr_dual_cd(prob, y, w, alpha, eps, upper_bound, max_iter, &innereps, NULL, get_nr_thread(nr_thread), shuffle_block, ws);
+	if(alpha_init != NULL)
+		for(i=0; i<l; i++)
+			alpha_init[i] = alpha[2*i];
 
 	info("\noptimization finished, #iter = %d\n",iter);
 	if (iter >= max_iter)
@@ -1371,10 +2790,6 @@ void solve_l2r_lr_dual(const problem *prob, double *w, double eps, double Cp, do
 			- upper_bound[GETI(i)] * log(upper_bound[GETI(i)]);
 	info("Objective value = %lf\n", v);
 
-	delete [] xTx;
-	delete [] alpha;
-	delete [] y;
-	delete [] index;
 }
 
 // A coordinate descent algorithm for 
@@ -1394,10 +2809,11 @@ void solve_l2r_lr_dual(const problem *prob, double *w, double eps, double Cp, do
 #define GETI(i) (y[i]+1)
 // To support weights for instances, use GETI(i) (i)
 
-static void solve_l1r_l2_svc(
-	problem *prob_col, double *w, double eps,
-	double Cp, double Cn)
+template <class V> static void solve_l1r_l2_svc(
+	const csr_view<V> *prob_col, double *w, double eps,
+	double Cp, double Cn, workspace *ws)
 {
+	work_frame frame(ws);
 	int l = prob_col->l;
 	int w_size = prob_col->n;
 	int j, s, iter = 0;
@@ -1409,22 +2825,21 @@ static void solve_l1r_l2_svc(
 	double d, G_loss, G, H;
 	double Gmax_old = INF;
 	double Gmax_new, Gnorm1_new;
-	double Gnorm1_init;
+	double Gnorm1_init = -1; // set at the first iteration
+	double Gnorm1_zero = 0; // violation at w = 0, the reference of a warm start
+	bool warm = false;
 	double d_old, d_diff;
 	double loss_old, loss_new;
 	double appxcond, cond;
 
-	int *index = new int[w_size];
-	schar *y = new schar[l];
-	double *b = new double[l]; // b = 1-ywTx
-	double *xj_sq = new double[w_size];
-	feature_node *x;
+	int *index = ws->take<int>(w_size);
+	schar *y = ws->take<schar>(l);
+	double *b = ws->take<double>(l); // b = 1-ywTx
+	double *xj_sq = ws->take<double>(w_size);
 
 	double C[3] = {Cn,0,Cp};
 
-	// Initial w can be set here.
-	for(j=0; j<w_size; j++)
-		w[j] = 0;
+	// w holds the initial point
 
 	for(j=0; j<l; j++)
 	{
@@ -1438,16 +2853,18 @@ static void solve_l1r_l2_svc(
 	{
 		index[j] = j;
 		xj_sq[j] = 0;
-		x = prob_col->x[j];
-		while(x->index != -1)
+		double G0 = 0;
+		for(auto x=row(prob_col,j); x.valid(); x.next())
 		{
-			int ind = x->index-1;
-			x->value *= y[ind]; // x->value stores yi*xij
-			double val = x->value;
+			int ind = x.index()-1;
+			double val = y[ind]*x.value();
 			b[ind] -= w[j]*val;
 			xj_sq[j] += C[GETI(ind)]*val*val;
-			x++;
+			G0 -= C[GETI(ind)]*val;
 		}
+		Gnorm1_zero += max(2*fabs(G0)-1, 0.0);
+		if(w[j] != 0)
+			warm = true;
 	}
 
 	while(iter < max_iter)
@@ -1457,7 +2874,7 @@ static void solve_l1r_l2_svc(
 
 		for(j=0; j<active_size; j++)
 		{
-			int i = j+rand()%(active_size-j);
+			int i = j+solver_rng.uniform(active_size-j);
 			swap(index[i], index[j]);
 		}
 
@@ -1467,18 +2884,16 @@ static void solve_l1r_l2_svc(
 			G_loss = 0;
 			H = 0;
 
-			x = prob_col->x[j];
-			while(x->index != -1)
+			for(auto x=row(prob_col,j); x.valid(); x.next())
 			{
-				int ind = x->index-1;
+				int ind = x.index()-1;
 				if(b[ind] > 0)
 				{
-					double val = x->value;
+					double val = y[ind]*x.value();
 					double tmp = C[GETI(ind)]*val;
 					G_loss -= tmp*b[ind];
 					H += tmp*val;
 				}
-				x++;
 			}
 			G_loss *= 2;
 
@@ -1533,11 +2948,10 @@ static void solve_l1r_l2_svc(
 				appxcond = xj_sq[j]*d*d + G_loss*d + cond;
 				if(appxcond <= 0)
 				{
-					x = prob_col->x[j];
-					while(x->index != -1)
+					for(auto x=row(prob_col,j); x.valid(); x.next())
 					{
-						b[x->index-1] += d_diff*x->value;
-						x++;
+						int ind = x.index()-1;
+						b[ind] += d_diff*(y[ind]*x.value());
 					}
 					break;
 				}
@@ -1546,31 +2960,27 @@ static void solve_l1r_l2_svc(
 				{
 					loss_old = 0;
 					loss_new = 0;
-					x = prob_col->x[j];
-					while(x->index != -1)
+					for(auto x=row(prob_col,j); x.valid(); x.next())
 					{
-						int ind = x->index-1;
+						int ind = x.index()-1;
 						if(b[ind] > 0)
 							loss_old += C[GETI(ind)]*b[ind]*b[ind];
-						double b_new = b[ind] + d_diff*x->value;
+						double b_new = b[ind] + d_diff*(y[ind]*x.value());
 						b[ind] = b_new;
 						if(b_new > 0)
 							loss_new += C[GETI(ind)]*b_new*b_new;
-						x++;
 					}
 				}
 				else
 				{
 					loss_new = 0;
-					x = prob_col->x[j];
-					while(x->index != -1)
+					for(auto x=row(prob_col,j); x.valid(); x.next())
 					{
-						int ind = x->index-1;
-						double b_new = b[ind] + d_diff*x->value;
+						int ind = x.index()-1;
+						double b_new = b[ind] + d_diff*(y[ind]*x.value());
 						b[ind] = b_new;
 						if(b_new > 0)
 							loss_new += C[GETI(ind)]*b_new*b_new;
-						x++;
 					}
 				}
 
@@ -1597,18 +3007,17 @@ static void solve_l1r_l2_svc(
 				for(int i=0; i<w_size; i++)
 				{
 					if(w[i]==0) continue;
-					x = prob_col->x[i];
-					while(x->index != -1)
+					for(auto x=row(prob_col,i); x.valid(); x.next())
 					{
-						b[x->index-1] -= w[i]*x->value;
-						x++;
+						int ind = x.index()-1;
+						b[ind] -= w[i]*(y[ind]*x.value());
 					}
 				}
 			}
 		}
 
 		if(iter == 0)
-			Gnorm1_init = Gnorm1_new;
+			Gnorm1_init = warm? Gnorm1_zero: Gnorm1_new;
 		iter++;
 		if(iter % 10 == 0)
 			info(".");
@@ -1639,12 +3048,6 @@ static void solve_l1r_l2_svc(
 	int nnz = 0;
 	for(j=0; j<w_size; j++)
 	{
-		x = prob_col->x[j];
-		while(x->index != -1)
-		{
-			x->value *= prob_col->y[x->index-1]; // restore x->value
-			x++;
-		}
 		if(w[j] != 0)
 		{
 			v += fabs(w[j]);
@@ -1658,10 +3061,6 @@ static void solve_l1r_l2_svc(
 	info("Objective value = %lf\n", v);
 	info("#nonzeros/#features = %d/%d\n", nnz, w_size);
 
-	delete [] index;
-	delete [] y;
-	delete [] b;
-	delete [] xj_sq;
 }
 
 // A coordinate descent algorithm for 
@@ -1681,10 +3080,11 @@ static void solve_l1r_l2_svc(
 #define GETI(i) (y[i]+1)
 // To support weights for instances, use GETI(i) (i)
 
-static void solve_l1r_lr(
-	const problem *prob_col, double *w, double eps,
-	double Cp, double Cn)
+template <class V> static void solve_l1r_lr(
+	const csr_view<V> *prob_col, double *w, double eps,
+	double Cp, double Cn, workspace *ws)
 {
+	work_frame frame(ws);
 	int l = prob_col->l;
 	int w_size = prob_col->n;
 	int j, s, newton_iter=0, iter=0;
@@ -1700,30 +3100,28 @@ static void solve_l1r_lr(
 	double w_norm, w_norm_new;
 	double z, G, H;
 	double Gnorm1_init;
+	double Gnorm1_zero = 0; // violation at w = 0, the reference of a warm start
 	double Gmax_old = INF;
 	double Gmax_new, Gnorm1_new;
 	double QP_Gmax_old = INF;
 	double QP_Gmax_new, QP_Gnorm1_new;
 	double delta, negsum_xTd, cond;
 
-	int *index = new int[w_size];
-	schar *y = new schar[l];
-	double *Hdiag = new double[w_size];
-	double *Grad = new double[w_size];
-	double *wpd = new double[w_size];
-	double *xjneg_sum = new double[w_size];
-	double *xTd = new double[l];
-	double *exp_wTx = new double[l];
-	double *exp_wTx_new = new double[l];
-	double *tau = new double[l];
-	double *D = new double[l];
-	feature_node *x;
+	int *index = ws->take<int>(w_size);
+	schar *y = ws->take<schar>(l);
+	double *Hdiag = ws->take<double>(w_size);
+	double *Grad = ws->take<double>(w_size);
+	double *wpd = ws->take<double>(w_size);
+	double *xjneg_sum = ws->take<double>(w_size);
+	double *xTd = ws->take<double>(l);
+	double *exp_wTx = ws->take<double>(l);
+	double *exp_wTx_new = ws->take<double>(l);
+	double *tau = ws->take<double>(l);
+	double *D = ws->take<double>(l);
 
 	double C[3] = {Cn,0,Cp};
 
-	// Initial w can be set here.
-	for(j=0; j<w_size; j++)
-		w[j] = 0;
+	// w holds the initial point
 
 	for(j=0; j<l; j++)
 	{
@@ -1742,16 +3140,17 @@ static void solve_l1r_lr(
 		wpd[j] = w[j];
 		index[j] = j;
 		xjneg_sum[j] = 0;
-		x = prob_col->x[j];
-		while(x->index != -1)
+		double tmp0 = 0;
+		for(auto x=row(prob_col,j); x.valid(); x.next())
 		{
-			int ind = x->index-1;
-			double val = x->value;
+			int ind = x.index()-1;
+			double val = x.value();
 			exp_wTx[ind] += w[j]*val;
 			if(y[ind] == -1)
 				xjneg_sum[j] += C[GETI(ind)]*val;
-			x++;
+			tmp0 += 0.5*C[GETI(ind)]*val;
 		}
+		Gnorm1_zero += max(fabs(xjneg_sum[j]-tmp0)-1, 0.0);
 	}
 	for(j=0; j<l; j++)
 	{
@@ -1774,13 +3173,11 @@ static void solve_l1r_lr(
 			Grad[j] = 0;
 
 			double tmp = 0;
-			x = prob_col->x[j];
-			while(x->index != -1)
+			for(auto x=row(prob_col,j); x.valid(); x.next())
 			{
-				int ind = x->index-1;
-				Hdiag[j] += x->value*x->value*D[ind];
-				tmp += x->value*tau[ind];
-				x++;
+				int ind = x.index()-1;
+				Hdiag[j] += x.value()*x.value()*D[ind];
+				tmp += x.value()*tau[ind];
 			}
 			Grad[j] = -tmp + xjneg_sum[j];
 
@@ -1812,7 +3209,7 @@ static void solve_l1r_lr(
 		}
 
 		if(newton_iter == 0)
-			Gnorm1_init = Gnorm1_new;
+			Gnorm1_init = (w_norm != 0)? Gnorm1_zero: Gnorm1_new;
 
 		if(Gnorm1_new <= eps*Gnorm1_init)
 			break;
@@ -1832,7 +3229,7 @@ static void solve_l1r_lr(
 
 			for(j=0; j<QP_active_size; j++)
 			{
-				int i = j+rand()%(QP_active_size-j);
+				int i = j+solver_rng.uniform(QP_active_size-j);
 				swap(index[i], index[j]);
 			}
 
@@ -1841,13 +3238,11 @@ static void solve_l1r_lr(
 				j = index[s];
 				H = Hdiag[j];
 
-				x = prob_col->x[j];
 				G = Grad[j] + (wpd[j]-w[j])*nu;
-				while(x->index != -1)
+				for(auto x=row(prob_col,j); x.valid(); x.next())
 				{
-					int ind = x->index-1;
-					G += x->value*D[ind]*xTd[ind];
-					x++;
+					int ind = x.index()-1;
+					G += x.value()*D[ind]*xTd[ind];
 				}
 
 				double Gp = G+1;
@@ -1890,12 +3285,10 @@ static void solve_l1r_lr(
 
 				wpd[j] += z;
 
-				x = prob_col->x[j];
-				while(x->index != -1)
+				for(auto x=row(prob_col,j); x.valid(); x.next())
 				{
-					int ind = x->index-1;
-					xTd[ind] += x->value*z;
-					x++;
+					int ind = x.index()-1;
+					xTd[ind] += x.value()*z;
 				}
 			}
 
@@ -1987,12 +3380,8 @@ static void solve_l1r_lr(
 			for(int i=0; i<w_size; i++)
 			{
 				if(w[i]==0) continue;
-				x = prob_col->x[i];
-				while(x->index != -1)
-				{
-					exp_wTx[x->index-1] += w[i]*x->value;
-					x++;
-				}
+				for(auto x=row(prob_col,i); x.valid(); x.next())
+					exp_wTx[x.index()-1] += w[i]*x.value();
 			}
 
 			for(int i=0; i<l; i++)
@@ -2032,32 +3421,23 @@ static void solve_l1r_lr(
 	info("Objective value = %lf\n", v);
 	info("#nonzeros/#features = %d/%d\n", nnz, w_size);
 
-	delete [] index;
-	delete [] y;
-	delete [] Hdiag;
-	delete [] Grad;
-	delete [] wpd;
-	delete [] xjneg_sum;
-	delete [] xTd;
-	delete [] exp_wTx;
-	delete [] exp_wTx_new;
-	delete [] tau;
-	delete [] D;
 }
 
-// transpose matrix X from row format to column format
-static void transpose(const problem *prob, feature_node **x_space_ret, problem *prob_col)
+// transpose matrix X from row format to column format: column j of X is
+// row j of prob_col, whose arrays are released by free_transpose(). The
+// values keep the precision they are stored in.
+template <class P, class V> static void transpose(const P *prob, csr_view<V> *prob_col)
 {
 	int i;
 	int l = prob->l;
 	int n = prob->n;
-	int nnz = 0;
-	int *col_ptr = new int[n+1];
-	feature_node *x_space;
+	long *col_ptr = new long[n+1];
+	long *pos = new long[n];
 	prob_col->l = l;
 	prob_col->n = n;
 	prob_col->y = new double[l];
-	prob_col->x = new feature_node*[n];
+	prob_col->bias = prob->bias;
+	prob_col->perm = NULL;
 
 	for(i=0; i<l; i++)
 		prob_col->y[i] = prob->y[i];
@@ -2065,45 +3445,56 @@ static void transpose(const problem *prob, feature_node **x_space_ret, problem *
 	for(i=0; i<n+1; i++)
 		col_ptr[i] = 0;
 	for(i=0; i<l; i++)
-	{
-		feature_node *x = prob->x[i];
-		while(x->index != -1)
-		{
-			nnz++;
-			col_ptr[x->index]++;
-			x++;
-		}
-	}
+		for(auto x=row(prob,i); x.valid(); x.next())
+			col_ptr[x.index()]++;
 	for(i=1; i<n+1; i++)
-		col_ptr[i] += col_ptr[i-1] + 1;
+		col_ptr[i] += col_ptr[i-1];
 
-	x_space = new feature_node[nnz+n];
+	int *row_idx = new int[col_ptr[n]];
+	V *val = new_values<V>(col_ptr[n]);
 	for(i=0; i<n; i++)
-		prob_col->x[i] = &x_space[col_ptr[i]];
+		pos[i] = col_ptr[i];
 
 	for(i=0; i<l; i++)
 	{
-		feature_node *x = prob->x[i];
-		while(x->index != -1)
+		for(auto x=row(prob,i); x.valid(); x.next())
 		{
-			int ind = x->index-1;
-			x_space[col_ptr[ind]].index = i+1; // starts from 1
-			x_space[col_ptr[ind]].value = x->value;
-			col_ptr[ind]++;
-			x++;
+			int ind = x.index()-1;
+			row_idx[pos[ind]] = i+1; // starts from 1
+			set_value(val, pos[ind], x.value());
+			pos[ind]++;
 		}
 	}
-	for(i=0; i<n; i++)
-		x_space[col_ptr[i]].index = -1;
 
-	*x_space_ret = x_space;
+	prob_col->row_ptr = col_ptr;
+	prob_col->col_idx = row_idx;
+	prob_col->val = val;
+
+	delete [] pos;
+}
+
+// transpose prob into prob_col unless it holds the transpose already, in
+// which case only the labels are copied
+template <class P, class V> static void get_transpose(const P *prob, csr_view<V> *prob_col)
+{
+	if(prob_col->row_ptr == NULL)
+		transpose(prob, prob_col);
+	else
+		for(int i=0; i<prob->l; i++)
+			prob_col->y[i] = prob->y[i];
+}
 
-	delete [] col_ptr;
+template <class V> static void free_transpose(csr_view<V> *prob_col)
+{
+	delete [] prob_col->y;
+	delete [] prob_col->row_ptr;
+	delete [] prob_col->col_idx;
+	delete [] prob_col->val;
 }
 
 // label: label name, start: begin of each class, count: #data of classes, perm: indices to the original data
 // perm, length l, must be allocated before calling this subroutine
-static void group_classes(const problem *prob, int *nr_class_ret, int **label_ret, int **start_ret, int **count_ret, int *perm)
+template <class P> static void group_classes(const P *prob, int *nr_class_ret, int **label_ret, int **start_ret, int **count_ret, int *perm)
 {
 	int l = prob->l;
 	int max_nr_class = 16;
@@ -2160,8 +3551,35 @@ static void group_classes(const problem *prob, int *nr_class_ret, int **label_re
 	free(data_label);
 }
 
-static void train_one(const problem *prob, const parameter *param, double *w, double Cp, double Cn)
+// C of each class, adjusted by the weights in param
+static double *get_weighted_C(const parameter *param, int nr_class, const int *label)
+{
+	int i, j;
+	double *weighted_C = Malloc(double, nr_class);
+	for(i=0;i<nr_class;i++)
+		weighted_C[i] = param->C;
+	for(i=0;i<param->nr_weight;i++)
+	{
+		for(j=0;j<nr_class;j++)
+			if(param->weight_label[i] == label[j])
+				break;
+		if(j == nr_class)
+			fprintf(stderr,"WARNING: class label %d specified in weight is not found\n", param->weight_label[i]);
+		else
+			weighted_C[j] *= param->weight[i];
+	}
+	return weighted_C;
+}
+
+// The primal solvers start from w as given. The dual ones start from
+// alpha_init if it is not NULL, and leave their solution in it. The L1
+// solvers work on prob by columns, which they keep in *prob_col, a view
+// with no arrays or a transpose of prob's instances whose labels may
+// differ, for the next call; the caller releases it with free_transpose().
+template <class P> static void train_one(const P *prob, const parameter *param, double *w, double *alpha_init, double Cp, double Cn,
+	csr_view<typename value_of<P>::type> *prob_col, workspace *ws)
 {
+	work_frame frame(ws);
 	double eps=param->eps;
 	int pos = 0;
 	int neg = 0;
@@ -2177,7 +3595,7 @@ static void train_one(const problem *prob, const parameter *param, double *w, do
 	{
 		case L2R_LR:
 		{
-			double *C = new double[prob->l];
+			double *C = ws->take<double>(prob->l);
 			for(int i = 0; i < prob->l; i++)
 			{
 				if(prob->y[i] > 0)
@@ -2185,17 +3603,16 @@ static void train_one(const problem *prob, const parameter *param, double *w, do
 				else
 					C[i] = Cn;
 			}
-			fun_obj=new l2r_lr_fun(prob, C);
-			TRON tron_obj(fun_obj, primal_solver_tol);
+			fun_obj=new l2r_lr_fun<P>(prob, C, param, ws);
+			TRON tron_obj(fun_obj, primal_solver_tol, 1000, ws->take<double>(7*(size_t)prob->n), param->precondition != 0);
 			tron_obj.set_print_string(liblinear_print_string);
 			tron_obj.tron(w);
 			delete fun_obj;
-			delete C;
 			break;
 		}
 		case L2R_L2LOSS_SVC:
 		{
-			double *C = new double[prob->l];
+			double *C = ws->take<double>(prob->l);
 			for(int i = 0; i < prob->l; i++)
 			{
 				if(prob->y[i] > 0)
@@ -2203,98 +3620,401 @@ static void train_one(const problem *prob, const parameter *param, double *w, do
 				else
 					C[i] = Cn;
 			}
-			fun_obj=new l2r_l2_svc_fun(prob, C);
-			TRON tron_obj(fun_obj, primal_solver_tol);
+			fun_obj=new l2r_l2_svc_fun<P>(prob, C, param, ws);
+			TRON tron_obj(fun_obj, primal_solver_tol, 1000, ws->take<double>(7*(size_t)prob->n), param->precondition != 0);
 			tron_obj.set_print_string(liblinear_print_string);
 			tron_obj.tron(w);
 			delete fun_obj;
-			delete C;
 			break;
 		}
 		case L2R_L2LOSS_SVC_DUAL:
-			solve_l2r_l1l2_svc(prob, w, eps, Cp, Cn, L2R_L2LOSS_SVC_DUAL);
+			solve_l2r_l1l2_svc(prob, w, alpha_init, eps, Cp, Cn, L2R_L2LOSS_SVC_DUAL, param->nr_thread, param->shuffle_block, ws);
 			break;
 		case L2R_L1LOSS_SVC_DUAL:
-			solve_l2r_l1l2_svc(prob, w, eps, Cp, Cn, L2R_L1LOSS_SVC_DUAL);
+			solve_l2r_l1l2_svc(prob, w, alpha_init, eps, Cp, Cn, L2R_L1LOSS_SVC_DUAL, param->nr_thread, param->shuffle_block, ws);
 			break;
 		case L1R_L2LOSS_SVC:
+			get_transpose(prob, prob_col);
+			solve_l1r_l2_svc(prob_col, w, primal_solver_tol, Cp, Cn, ws);
+			break;
+		case L1R_LR:
+			get_transpose(prob, prob_col);
+			solve_l1r_lr(prob_col, w, primal_solver_tol, Cp, Cn, ws);
+			break;
+		case L2R_LR_DUAL:
+			solve_l2r_lr_dual(prob, w, alpha_init, eps, Cp, Cn, param->nr_thread, param->shuffle_block, ws);
+			break;
+		case L2R_L2LOSS_SVR:
 		{
-			problem prob_col;
-			feature_node *x_space = NULL;
-			transpose(prob, &x_space ,&prob_col);
-			solve_l1r_l2_svc(&prob_col, w, primal_solver_tol, Cp, Cn);
-			delete [] prob_col.y;
-			delete [] prob_col.x;
-			delete [] x_space;
+			double *C = ws->take<double>(prob->l);
+			for(int i = 0; i < prob->l; i++)
+				C[i] = param->C;
+
+			fun_obj=new l2r_l2_svr_fun<P>(prob, C, param, ws);
+			TRON tron_obj(fun_obj, param->eps, 1000, ws->take<double>(7*(size_t)prob->n), param->precondition != 0);
+			tron_obj.set_print_string(liblinear_print_string);
+			tron_obj.tron(w);
+			delete fun_obj;
+			break;
+
+		}
+		case L2R_L1LOSS_SVR_DUAL:
+			solve_l2r_l1l2_svr(prob, w, alpha_init, param, L2R_L1LOSS_SVR_DUAL, ws);
+			break;
+		case L2R_L2LOSS_SVR_DUAL:
+			solve_l2r_l1l2_svr(prob, w, alpha_init, param, L2R_L2LOSS_SVR_DUAL, ws);
+			break;
+		default:
+			fprintf(stderr, "ERROR: unknown solver_type\n");
 			break;
+	}
+}
+
+// Cycles through the blocks of src in order. While the caller trains on
+// the block returned by next(), the following one is read by another
+// thread, so at most two blocks are in memory at a time.
+class block_cycle
+{
+public:
+	block_cycle(const block_source *src);
+	~block_cycle();
+	const problem *next(int *b);
+
+private:
+	const block_source *src;
+	problem blk[2];
+	int cur;	// blk[cur] holds block b_cur
+	int b_cur;	// -1 before the first call of next()
+	std::thread loader;
+};
+
+block_cycle::block_cycle(const block_source *src)
+{
+	this->src = src;
+	cur = 0;
+	b_cur = -1;
+}
+
+block_cycle::~block_cycle()
+{
+	if(loader.joinable())
+		loader.join();
+	if(b_cur >= 0)
+	{
+		src->free_block(src, &blk[cur]);
+		if(src->nr_block > 1)
+			src->free_block(src, &blk[cur^1]);
+	}
+}
+
+const problem *block_cycle::next(int *b)
+{
+	int nr_block = src->nr_block;
+
+	if(b_cur < 0)
+	{
+		b_cur = 0;
+		src->load_block(src, 0, &blk[cur]);
+	}
+	else if(nr_block > 1)
+	{
+		loader.join();
+		src->free_block(src, &blk[cur]);
+		cur ^= 1;
+		b_cur = (b_cur+1)%nr_block;
+	}
+	// a single block simply stays in memory
+	if(nr_block > 1)
+		loader = std::thread(src->load_block, src, (b_cur+1)%nr_block, &blk[cur^1]);
+
+	*b = b_cur;
+	return &blk[cur];
+}
+
+// Block minimization for the dual problems of -s 1, 3 and 7 when the data
+// do not fit in memory: w and alpha stay in memory while the blocks are
+// visited in turn, and each visit runs the dual CD solver on the
+// instances of the block for at most max_inner_iter passes. The first
+// pass on a block measures the violation at the point where the block is
+// visited, so the usual stopping condition is checked over a whole sweep.
+//
+// See Yu et al., KDD 2010
+
+// alpha_init as in solve_l2r_l1l2_svc() and solve_l2r_lr_dual()
+static void solve_l2r_dual_blocks(
+	const block_source *src, int pos_label, double *w, double *alpha_init, double eps,
+	double Cp, double Cn, int solver_type, int nr_thread, int shuffle_block, workspace *ws)
+{
+	work_frame frame(ws);
+	int l = src->l;
+	int w_size = src->n;
+	int nr_block = src->nr_block;
+	int i, b, k, iter = 0;
+	int max_iter = 1000;
+	int max_inner_iter = 10;
+	bool lr = (solver_type == L2R_LR_DUAL);
+	nr_thread = get_nr_thread(nr_thread);
+	double *alpha = ws->take<double>(lr? 2*l: l);
+	double innereps = 1e-2;
+
+	int max_block_l = 0;
+	for(b=0; b<nr_block; b++)
+		max_block_l = max(max_block_l, src->start[b+1]-src->start[b]);
+	schar *y = ws->take<schar>(max_block_l);
+
+	// default solver_type: L2R_L2LOSS_SVC_DUAL
+	double diag[3] = {0.5/Cn, 0, 0.5/Cp};
+	double upper_bound[3] = {INF, 0, INF};
+	if(solver_type != L2R_L2LOSS_SVC_DUAL)
+	{
+		diag[0] = 0;
+		diag[2] = 0;
+		upper_bound[0] = Cn;
+		upper_bound[2] = Cp;
+	}
+
+	for(i=0; i<w_size; i++)
+		w[i] = 0;
+
+	block_cycle blocks(src);
+	if(lr)
+	{
+		for(i=0; i<l; i++)
+		{
+			double C = upper_bound[((int)src->y[i] == pos_label)? 2: 0];
+			double a0 = min(0.001*C, 1e-8);
+			alpha[2*i] = (alpha_init != NULL)? min(max(alpha_init[i], a0), C - a0): a0;
+			alpha[2*i+1] = C - alpha[2*i];
+		}
+	}
+	else
+	{
+		for(i=0; i<l; i++)
+		{
+			double U = upper_bound[((int)src->y[i] == pos_label)? 2: 0];
+			alpha[i] = (alpha_init != NULL)? min(max(alpha_init[i], 0.0), U): 0;
+		}
+	}
+	// as in solve_l2r_lr_dual; unless alpha is zero, w takes a sweep
+	if(lr || alpha_init != NULL)
+	{
+		for(k=0; k<nr_block; k++)
+		{
+			const problem *blk = blocks.next(&b);
+			int s = src->start[b];
+			for(i=0; i<blk->l; i++)
+			{
+				double a = lr? alpha[2*(s+i)]: alpha[s+i];
+				double d = ((int)src->y[s+i] == pos_label)? a: -a;
+				feature_node *xi = blk->x[i];
+				while (xi->index != -1)
+				{
+					w[xi->index-1] += d*xi->value;
+					xi++;
+				}
+			}
 		}
-		case L1R_LR:
+	}
+
+	while (iter < max_iter)
+	{
+		double PGmax = -INF, PGmin = INF, Gmax = 0;
+
+		for(k=0; k<nr_block; k++)
 		{
-			problem prob_col;
-			feature_node *x_space = NULL;
-			transpose(prob, &x_space ,&prob_col);
-			solve_l1r_lr(&prob_col, w, primal_solver_tol, Cp, Cn);
-			delete [] prob_col.y;
-			delete [] prob_col.x;
-			delete [] x_space;
-			break;
+			const problem *blk = blocks.next(&b);
+			int s = src->start[b];
+			for(i=0; i<blk->l; i++)
+				y[i] = ((int)src->y[s+i] == pos_label)? +1: -1;
+
+			if(lr)
+			{
+				double G = 0;
+				solve_l2r_lr_dual_cd(blk, y, w, &alpha[2*s], eps, upper_bound, max_inner_iter, &innereps, &G, nr_thread, shuffle_block, ws);
+				Gmax = max(Gmax, G);
+			}
+			else
+			{
+				double PG[2] = {-INF, INF};
+				solve_l2r_l1l2_svc_cd(blk, y, w, &alpha[s], eps, diag, upper_bound, max_inner_iter, PG, nr_thread, shuffle_block, ws);
+				PGmax = max(PGmax, PG[0]);
+				PGmin = min(PGmin, PG[1]);
+			}
 		}
-		case L2R_LR_DUAL:
-			solve_l2r_lr_dual(prob, w, eps, Cp, Cn);
-			break;
-		case L2R_L2LOSS_SVR:
-		{
-			double *C = new double[prob->l];
-			for(int i = 0; i < prob->l; i++)
-				C[i] = param->C;
 
-			fun_obj=new l2r_l2_svr_fun(prob, C, param->p);
-			TRON tron_obj(fun_obj, param->eps);
-			tron_obj.set_print_string(liblinear_print_string);
-			tron_obj.tron(w);
-			delete fun_obj;
-			delete C;
-			break;
+		iter++;
+		info(".");
 
-		}
-		case L2R_L1LOSS_SVR_DUAL:
-			solve_l2r_l1l2_svr(prob, w, param, L2R_L1LOSS_SVR_DUAL);
-			break;
-		case L2R_L2LOSS_SVR_DUAL:
-			solve_l2r_l1l2_svr(prob, w, param, L2R_L2LOSS_SVR_DUAL);
-			break;
-		default:
-			fprintf(stderr, "ERROR: unknown solver_type\n");
+		if(lr? Gmax < eps: PGmax - PGmin <= eps)
 			break;
 	}
+
+	if(alpha_init != NULL)
+		for(i=0; i<l; i++)
+			alpha_init[i] = lr? alpha[2*i]: alpha[i];
+
+	info("\noptimization finished, #sweep = %d\n",iter);
+	if (iter >= max_iter)
+		info("\nWARNING: reaching max number of iterations\n\n");
+	if(!lr)
+	{
+		int nSV = 0;
+		for(i=0; i<l; i++)
+			if(alpha[i] > 0)
+				++nSV;
+		info("nSV = %d\n",nSV);
+	}
+
 }
 
-//
-// Interface functions
-//
-model* train(const problem *prob, const parameter *param)
+// w = column k of the nr_w columns of param->init_sol, or 0 without one
+static void get_init_w(const parameter *param, int w_size, int k, int nr_w, double *w)
+{
+	for(int j=0;j<w_size;j++)
+		w[j] = (param->init_sol != NULL)? param->init_sol[(size_t)j*nr_w+k]: 0;
+}
+
+// param->init_alpha has a row of nr values per instance. For the
+// instances perm[0], ..., perm[l-1] (0, ..., l-1 if perm is NULL), copy
+// width values of their rows from column k on into sub_alpha, a row each;
+// put_init_alpha() copies them back.
+static double *get_init_alpha(const parameter *param, const int *perm, int l, int nr, int k, int width)
+{
+	if(param->init_alpha == NULL)
+		return NULL;
+	double *sub_alpha = Malloc(double, (size_t)l*width);
+	for(int i=0;i<l;i++)
+	{
+		const double *row = &param->init_alpha[(size_t)((perm != NULL)? perm[i]: i)*nr+k];
+		for(int t=0;t<width;t++)
+			sub_alpha[(size_t)i*width+t] = row[t];
+	}
+	return sub_alpha;
+}
+
+static void put_init_alpha(const parameter *param, const int *perm, int l, int nr, int k, int width, double *sub_alpha)
+{
+	if(sub_alpha == NULL)
+		return;
+	for(int i=0;i<l;i++)
+	{
+		double *row = &param->init_alpha[(size_t)((perm != NULL)? perm[i]: i)*nr+k];
+		for(int t=0;t<width;t++)
+			row[t] = sub_alpha[(size_t)i*width+t];
+	}
+	free(sub_alpha);
+}
+
+// sub_prob gets the instances of prob in the order of perm, with room for
+// their labels; free_subproblem() releases it
+static void permute_problem(const problem *prob, const int *perm, problem *sub_prob)
 {
-	int i,j;
 	int l = prob->l;
-	int n = prob->n;
-	int w_size = prob->n;
-	model *model_ = Malloc(model,1);
+	sub_prob->l = l;
+	sub_prob->n = prob->n;
+	sub_prob->bias = prob->bias;
+	sub_prob->x = Malloc(feature_node *,l);
+	sub_prob->y = Malloc(double,l);
+	for(int i=0;i<l;i++)
+		sub_prob->x[i] = prob->x[perm[i]];
+}
+
+// a view shares the arrays of prob and composes perm with its own
+template <class View> static void permute_problem(const View *prob, const int *perm, View *sub_prob)
+{
+	int l = prob->l;
+	int *sub_perm = Malloc(int,l);
+	for(int i=0;i<l;i++)
+		sub_perm[i] = (prob->perm != NULL)? prob->perm[perm[i]]: perm[i];
+	*sub_prob = *prob;
+	sub_prob->y = Malloc(double,l);
+	sub_prob->perm = sub_perm;
+}
+
+static void free_subproblem(problem *sub_prob)
+{
+	free(sub_prob->x);
+	free(sub_prob->y);
+}
+
+template <class View> static void free_subproblem(View *sub_prob)
+{
+	free((void *)sub_prob->perm);
+	free(sub_prob->y);
+}
 
+// a model of prob for param with C in place of param->C, with no w or
+// classes yet
+template <class P> static model *new_model(const P *prob, const parameter *param, double C)
+{
+	model *model_ = Malloc(model,1);
 	if(prob->bias>=0)
-		model_->nr_feature=n-1;
+		model_->nr_feature=prob->n-1;
 	else
-		model_->nr_feature=n;
+		model_->nr_feature=prob->n;
 	model_->param = *param;
+	model_->param.C = C;
+	model_->param.workspace = NULL;
+	model_->param.init_sol = NULL;
+	model_->param.init_alpha = NULL;
 	model_->bias = prob->bias;
+	return model_;
+}
+
+// Train models[k] for C[k], k = 0, ..., nr_C-1. The first solve starts
+// from param->init_sol and param->init_alpha, each later one from the
+// solution for the previous C, with the dual variables scaled by the
+// ratio of the two. The grouping of the classes and the data by columns
+// are computed once for all of them.
+template <class P> static void train_problem(const P *prob, const parameter *param, int nr_C, const double *C, model **models)
+{
+	int i,j,c;
+	int l = prob->l;
+	int n = prob->n;
+	int w_size = prob->n;
+	workspace *ws = param->workspace ? param->workspace : new workspace;
+	csr_view<typename value_of<P>::type> prob_col = {};
+	solver_rng.seed((uint64_t)param->seed);
+
+	bool dual = param->solver_type != L2R_LR &&
+		param->solver_type != L2R_L2LOSS_SVC &&
+		param->solver_type != L2R_L2LOSS_SVR &&
+		param->solver_type != L1R_L2LOSS_SVC &&
+		param->solver_type != L1R_LR;
+
+	// cur is param for the current C; its init_alpha carries the dual
+	// variables along the path
+	parameter cur = *param;
+	double *path_alpha = NULL;
 
 	if(param->solver_type == L2R_L2LOSS_SVR ||
 	   param->solver_type == L2R_L1LOSS_SVR_DUAL ||
 	   param->solver_type == L2R_L2LOSS_SVR_DUAL)
 	{
-		model_->w = Malloc(double, w_size);
-		model_->nr_class = 2;
-		model_->label = NULL;
-		train_one(prob, param, &model_->w[0], 0, 0);
+		if(dual && nr_C > 1 && cur.init_alpha == NULL)
+		{
+			cur.init_alpha = path_alpha = Malloc(double, l);
+			for(i=0;i<l;i++)
+				path_alpha[i] = 0;
+		}
+		for(c=0;c<nr_C;c++)
+		{
+			model *model_ = new_model(prob, param, C[c]);
+			if(c > 0)
+			{
+				cur.init_sol = models[c-1]->w;
+				if(dual)
+					for(i=0;i<l;i++)
+						cur.init_alpha[i] *= C[c]/C[c-1];
+			}
+			cur.C = C[c];
+			model_->w = Malloc(double, w_size);
+			model_->nr_class = 2;
+			model_->label = NULL;
+			get_init_w(&cur, w_size, 0, 1, model_->w);
+			train_one(prob, &cur, &model_->w[0], cur.init_alpha, 0, 0, &prob_col, ws);
+			models[c] = model_;
+		}
 	}
 	else
 	{
@@ -2307,102 +4027,398 @@ model* train(const problem *prob, const parameter *param)
 		// group training data of the same class
 		group_classes(prob,&nr_class,&label,&start,&count,perm);
 
-		model_->nr_class=nr_class;
-		model_->label = Malloc(int,nr_class);
-		for(i=0;i<nr_class;i++)
-			model_->label[i] = label[i];
-
-		// calculate weighted C
-		double *weighted_C = Malloc(double, nr_class);
-		for(i=0;i<nr_class;i++)
-			weighted_C[i] = param->C;
-		for(i=0;i<param->nr_weight;i++)
+		// dual variables per instance; Crammer and Singer keeps its own
+		// between the values of C, only the nonzeros of them
+		int nr_sub = (nr_class == 2 && param->solver_type != MCSVM_CS)? 1: nr_class;
+		bool cs_path = param->solver_type == MCSVM_CS && nr_C > 1 && cur.init_alpha == NULL;
+		cs_duals path_cs;
+		if(dual && nr_C > 1 && cur.init_alpha == NULL && !cs_path)
 		{
-			for(j=0;j<nr_class;j++)
-				if(param->weight_label[i] == label[j])
-					break;
-			if(j == nr_class)
-				fprintf(stderr,"WARNING: class label %d specified in weight is not found\n", param->weight_label[i]);
-			else
-				weighted_C[j] *= param->weight[i];
+			cur.init_alpha = path_alpha = Malloc(double, (size_t)l*nr_sub);
+			for(size_t t=0;t<(size_t)l*nr_sub;t++)
+				path_alpha[t] = 0;
 		}
 
 		// constructing the subproblem
-		feature_node **x = Malloc(feature_node *,l);
-		for(i=0;i<l;i++)
-			x[i] = prob->x[perm[i]];
-
 		int k;
-		problem sub_prob;
-		sub_prob.l = l;
-		sub_prob.n = n;
-		sub_prob.x = Malloc(feature_node *,sub_prob.l);
-		sub_prob.y = Malloc(double,sub_prob.l);
+		P sub_prob;
+		permute_problem(prob, perm, &sub_prob);
 
-		for(k=0; k<sub_prob.l; k++)
-			sub_prob.x[k] = x[k];
-
-		// multi-class svm by Crammer and Singer
-		if(param->solver_type == MCSVM_CS)
+		for(c=0;c<nr_C;c++)
 		{
-			model_->w=Malloc(double, n*nr_class);
+			model *model_ = new_model(prob, param, C[c]);
+			model_->nr_class=nr_class;
+			model_->label = Malloc(int,nr_class);
 			for(i=0;i<nr_class;i++)
-				for(j=start[i];j<start[i]+count[i];j++)
-					sub_prob.y[j] = i;
-			Solver_MCSVM_CS Solver(&sub_prob, nr_class, weighted_C, param->eps);
-			Solver.Solve(model_->w);
-		}
-		else
-		{
-			if(nr_class == 2)
+				model_->label[i] = label[i];
+
+			if(c > 0)
 			{
-				model_->w=Malloc(double, w_size);
+				cur.init_sol = models[c-1]->w;
+				if(dual && cur.init_alpha != NULL)
+					for(size_t t=0;t<(size_t)l*nr_sub;t++)
+						cur.init_alpha[t] *= C[c]/C[c-1];
+			}
+			cur.C = C[c];
 
-				int e0 = start[0]+count[0];
-				k=0;
-				for(; k<e0; k++)
-					sub_prob.y[k] = +1;
-				for(; k<sub_prob.l; k++)
-					sub_prob.y[k] = -1;
+			// calculate weighted C
+			double *weighted_C = get_weighted_C(&cur, nr_class, label);
 
-				train_one(&sub_prob, param, &model_->w[0], weighted_C[0], weighted_C[1]);
+			// multi-class svm by Crammer and Singer
+			if(param->solver_type == MCSVM_CS)
+			{
+				model_->w=Malloc(double, n*nr_class);
+				for(i=0;i<nr_class;i++)
+					for(j=start[i];j<start[i]+count[i];j++)
+						sub_prob.y[j] = i;
+				Solver_MCSVM_CS<P> Solver(&sub_prob, nr_class, weighted_C, param->nr_thread, ws, param->eps);
+				if(cs_path)
+					Solver.Solve(model_->w, &path_cs, (c > 0)? C[c]/C[c-1]: 1);
+				else
+				{
+					double *alpha = get_init_alpha(&cur, perm, l, nr_class, 0, nr_class);
+					Solver.Solve(model_->w, alpha);
+					put_init_alpha(&cur, perm, l, nr_class, 0, nr_class, alpha);
+				}
 			}
 			else
 			{
-				model_->w=Malloc(double, w_size*nr_class);
-				double *w=Malloc(double, w_size);
-				for(i=0;i<nr_class;i++)
+				if(nr_class == 2)
 				{
-					int si = start[i];
-					int ei = si+count[i];
+					model_->w=Malloc(double, w_size);
 
+					int e0 = start[0]+count[0];
 					k=0;
-					for(; k<si; k++)
-						sub_prob.y[k] = -1;
-					for(; k<ei; k++)
+					for(; k<e0; k++)
 						sub_prob.y[k] = +1;
 					for(; k<sub_prob.l; k++)
 						sub_prob.y[k] = -1;
 
-					train_one(&sub_prob, param, w, weighted_C[i], param->C);
-
-					for(int j=0;j<w_size;j++)
-						model_->w[j*nr_class+i] = w[j];
+					double *alpha = get_init_alpha(&cur, perm, l, 1, 0, 1);
+					get_init_w(&cur, w_size, 0, 1, model_->w);
+					train_one(&sub_prob, &cur, &model_->w[0], alpha, weighted_C[0], weighted_C[1], &prob_col, ws);
+					put_init_alpha(&cur, perm, l, 1, 0, 1, alpha);
+				}
+				else
+				{
+					model_->w=Malloc(double, w_size*nr_class);
+					double *w=Malloc(double, w_size);
+					for(i=0;i<nr_class;i++)
+					{
+						int si = start[i];
+						int ei = si+count[i];
+
+						k=0;
+						for(; k<si; k++)
+							sub_prob.y[k] = -1;
+						for(; k<ei; k++)
+							sub_prob.y[k] = +1;
+						for(; k<sub_prob.l; k++)
+							sub_prob.y[k] = -1;
+
+						double *alpha = get_init_alpha(&cur, perm, l, nr_class, i, 1);
+						get_init_w(&cur, w_size, i, nr_class, w);
+						train_one(&sub_prob, &cur, w, alpha, weighted_C[i], cur.C, &prob_col, ws);
+						put_init_alpha(&cur, perm, l, nr_class, i, 1, alpha);
+
+						for(int j=0;j<w_size;j++)
+							model_->w[j*nr_class+i] = w[j];
+					}
+					free(w);
 				}
-				free(w);
-			}
 
+			}
+			free(weighted_C);
+			models[c] = model_;
 		}
 
-		free(x);
 		free(label);
 		free(start);
 		free(count);
 		free(perm);
-		free(sub_prob.x);
-		free(sub_prob.y);
-		free(weighted_C);
+		free_subproblem(&sub_prob);
+	}
+	free_transpose(&prob_col);
+	free(path_alpha);
+	if(ws != param->workspace)
+		delete ws;
+}
+
+template <class P> static model* train_problem(const P *prob, const parameter *param)
+{
+	model *model_;
+	train_problem(prob, param, 1, &param->C, &model_);
+	return model_;
+}
+
+//
+// Interface functions
+//
+model* train(const problem *prob, const parameter *param)
+{
+	return train_problem(prob, param);
+}
+
+model** train_path(const problem *prob, const parameter *param, int nr_C, const double *C)
+{
+	if(nr_C < 1 || C[0] <= 0)
+		return NULL;
+	for(int i=1;i<nr_C;i++)
+		if(C[i] <= C[i-1])
+			return NULL;
+	model **models = Malloc(model *,nr_C);
+	train_problem(prob, param, nr_C, C, models);
+	return models;
+}
+
+// the fields a view of the arrays of prob shares with every other kind
+template <class V, class View> static void init_view(const csr_problem *prob, const V *val, View *view)
+{
+	view->l = prob->l;
+	view->n = prob->n;
+	view->y = prob->y;
+	view->bias = prob->bias;
+	view->row_ptr = prob->row_ptr;
+	view->val = val;
+	view->perm = NULL;
+}
+
+// train on the arrays of prob with values of type V in val
+template <class V> static model* train_csr_values(const csr_problem *prob, const V *val, const parameter *param)
+{
+	if(prob->col_idx != NULL)
+	{
+		csr_view<V> view;
+		init_view(prob, val, &view);
+		view.col_idx = prob->col_idx;
+		return train_problem(&view, param);
+	}
+	packed_view<V> view;
+	init_view(prob, val, &view);
+	view.byte_ptr = prob->byte_ptr;
+	view.idx_bytes = prob->idx_bytes;
+	return train_problem(&view, param);
+}
+
+model* train_csr(const csr_problem *prob, const parameter *param)
+{
+	if(prob->val != NULL)
+		return train_csr_values(prob, prob->val, param);
+	else if(prob->fval != NULL)
+		return train_csr_values(prob, prob->fval, param);
+	else
+		return train_csr_values(prob, (const unit *)NULL, param);
+}
+
+// copy prob into csr with the values stored as V in *val, or with no
+// values at all if every one of them is 1
+template <class V> static int copy_to_csr(const problem *prob, csr_problem *csr, V **val)
+{
+	int i;
+	int l = prob->l;
+	long nnz = 0;
+	bool binary = true;
+
+	for(i=0;i<l;i++)
+		for(const feature_node *x=prob->x[i]; x->index != -1; x++)
+		{
+			if(x->value != 1)
+				binary = false;
+			nnz++;
+		}
+
+	csr->l = l;
+	csr->n = prob->n;
+	csr->bias = prob->bias;
+	csr->val = NULL;
+	csr->fval = NULL;
+	csr->byte_ptr = NULL;
+	csr->idx_bytes = NULL;
+	csr->y = Malloc(double,l);
+	csr->row_ptr = Malloc(long,l+1);
+	csr->col_idx = Malloc(int,nnz);
+	if(!binary)
+		*val = Malloc(V,nnz);
+	if(csr->y == NULL || csr->row_ptr == NULL || (nnz > 0 && (csr->col_idx == NULL || (!binary && *val == NULL))))
+	{
+		free_csr_problem(csr);
+		return -1;
+	}
+
+	long k = 0;
+	for(i=0;i<l;i++)
+	{
+		csr->y[i] = prob->y[i];
+		csr->row_ptr[i] = k;
+		for(const feature_node *x=prob->x[i]; x->index != -1; x++)
+		{
+			csr->col_idx[k] = x->index;
+			if(!binary)
+				(*val)[k] = (V)x->value;
+			k++;
+		}
+	}
+	csr->row_ptr[l] = k;
+	return 0;
+}
+
+int problem_to_csr(const problem *prob, csr_problem *csr)
+{
+	return copy_to_csr(prob, csr, &csr->val);
+}
+
+int problem_to_csr_float(const problem *prob, csr_problem *csr)
+{
+	return copy_to_csr(prob, csr, &csr->fval);
+}
+
+// bytes taken by gap as a varint
+static inline int varint_size(unsigned int gap)
+{
+	int size = 1;
+	for(; gap >= 0x80; gap >>= 7)
+		size++;
+	return size;
+}
+
+int pack_csr_indices(csr_problem *csr)
+{
+	int i;
+	int l = csr->l;
+	long k, nbyte = 0;
+
+	if(csr->col_idx == NULL)
+		return 0;
+	for(i=0;i<l;i++)
+	{
+		int prev = 0;
+		for(k=csr->row_ptr[i]; k<csr->row_ptr[i+1]; k++)
+		{
+			nbyte += varint_size((unsigned int)(csr->col_idx[k]-prev));
+			prev = csr->col_idx[k];
+		}
+	}
+
+	long *byte_ptr = Malloc(long,l+1);
+	unsigned char *idx_bytes = Malloc(unsigned char,nbyte);
+	if(byte_ptr == NULL || (nbyte > 0 && idx_bytes == NULL))
+	{
+		free(byte_ptr);
+		free(idx_bytes);
+		return -1;
+	}
+
+	unsigned char *p = idx_bytes;
+	for(i=0;i<l;i++)
+	{
+		int prev = 0;
+		byte_ptr[i] = p-idx_bytes;
+		for(k=csr->row_ptr[i]; k<csr->row_ptr[i+1]; k++)
+		{
+			unsigned int gap = (unsigned int)(csr->col_idx[k]-prev);
+			for(; gap >= 0x80; gap >>= 7)
+				*p++ = (unsigned char)(gap | 0x80);
+			*p++ = (unsigned char)gap;
+			prev = csr->col_idx[k];
+		}
+	}
+	byte_ptr[l] = p-idx_bytes;
+
+	free(csr->col_idx);
+	csr->col_idx = NULL;
+	csr->byte_ptr = byte_ptr;
+	csr->idx_bytes = idx_bytes;
+	return 0;
+}
+
+void free_csr_problem(csr_problem *csr)
+{
+	free(csr->y);
+	free(csr->row_ptr);
+	free(csr->col_idx);
+	free(csr->val);
+	free(csr->fval);
+	free(csr->byte_ptr);
+	free(csr->idx_bytes);
+	csr->y = NULL;
+	csr->row_ptr = NULL;
+	csr->col_idx = NULL;
+	csr->val = NULL;
+	csr->fval = NULL;
+	csr->byte_ptr = NULL;
+	csr->idx_bytes = NULL;
+}
+
+// Same models as train() for -s 1, 3 and 7, with the instances read block
+// by block from src; only the labels, w and alpha are kept in memory.
+model* train_blocks(const block_source *src, const parameter *param)
+{
+	int i, j;
+	int w_size = src->n;
+	int nr_class;
+	int *label = NULL;
+	int *start = NULL;
+	int *count = NULL;
+	int *perm = Malloc(int,src->l);
+	model *model_ = Malloc(model,1);
+	workspace *ws = param->workspace ? param->workspace : new workspace;
+	solver_rng.seed((uint64_t)param->seed);
+
+	if(src->bias>=0)
+		model_->nr_feature=w_size-1;
+	else
+		model_->nr_feature=w_size;
+	model_->param = *param;
+	model_->param.workspace = NULL;
+	model_->param.init_sol = NULL;
+	model_->param.init_alpha = NULL;
+	model_->bias = src->bias;
+
+	// only the labels are needed to find the classes
+	problem labels;
+	labels.l = src->l;
+	labels.n = src->n;
+	labels.y = src->y;
+	labels.x = NULL;
+	labels.bias = src->bias;
+	group_classes(&labels,&nr_class,&label,&start,&count,perm);
+
+	model_->nr_class=nr_class;
+	model_->label = Malloc(int,nr_class);
+	for(i=0;i<nr_class;i++)
+		model_->label[i] = label[i];
+
+	double *weighted_C = get_weighted_C(param, nr_class, label);
+
+	if(nr_class == 2)
+	{
+		model_->w=Malloc(double, w_size);
+		double *alpha = get_init_alpha(param, NULL, src->l, 1, 0, 1);
+		solve_l2r_dual_blocks(src, label[0], model_->w, alpha, param->eps, weighted_C[0], weighted_C[1], param->solver_type, param->nr_thread, param->shuffle_block, ws);
+		put_init_alpha(param, NULL, src->l, 1, 0, 1, alpha);
+	}
+	else
+	{
+		model_->w=Malloc(double, w_size*nr_class);
+		double *w=Malloc(double, w_size);
+		for(i=0;i<nr_class;i++)
+		{
+			double *alpha = get_init_alpha(param, NULL, src->l, nr_class, i, 1);
+			solve_l2r_dual_blocks(src, label[i], w, alpha, param->eps, weighted_C[i], param->C, param->solver_type, param->nr_thread, param->shuffle_block, ws);
+			put_init_alpha(param, NULL, src->l, nr_class, i, 1, alpha);
+			for(j=0;j<w_size;j++)
+				model_->w[j*nr_class+i] = w[j];
+		}
+		free(w);
 	}
+
+	free(label);
+	free(start);
+	free(count);
+	free(perm);
+	free(weighted_C);
+	if(ws != param->workspace)
+		delete ws;
 	return model_;
 }
 
@@ -2412,11 +4428,17 @@ void cross_validation(const problem *prob, const parameter *param, int nr_fold,
 	int *fold_start = Malloc(int,nr_fold+1);
 	int l = prob->l;
 	int *perm = Malloc(int,l);
+	// the folds share one workspace; init_alpha has no rows for them
+	parameter fold_param = *param;
+	if(fold_param.workspace == NULL)
+		fold_param.workspace = new workspace;
+	fold_param.init_alpha = NULL;
 
+	solver_rng.seed((uint64_t)param->seed);
 	for(i=0;i<l;i++) perm[i]=i;
 	for(i=0;i<l;i++)
 	{
-		int j = i+rand()%(l-i);
+		int j = i+solver_rng.uniform(l-i);
 		swap(perm[i],perm[j]);
 	}
 	for(i=0;i<=nr_fold;i++)
@@ -2448,18 +4470,20 @@ void cross_validation(const problem *prob, const parameter *param, int nr_fold,
 			subprob.y[k] = prob->y[perm[j]];
 			++k;
 		}
-		struct model *submodel = train(&subprob,param);
+		struct model *submodel = train(&subprob,&fold_param);
 		for(j=begin;j<end;j++)
 			target[perm[j]] = predict(submodel,prob->x[perm[j]]);
 		free_and_destroy_model(&submodel);
 		free(subprob.x);
 		free(subprob.y);
 	}
+	if(fold_param.workspace != param->workspace)
+		delete fold_param.workspace;
 	free(fold_start);
 	free(perm);
 }
 
-double predict_values(const struct model *model_, const struct feature_node *x, double *dec_values)
+template <class R> static double predict_row(const model *model_, R x, double *dec_values)
 {
 	int idx;
 	int n;
@@ -2470,21 +4494,17 @@ double predict_values(const struct model *model_, const struct feature_node *x,
 	double *w=model_->w;
 	int nr_class=model_->nr_class;
 	int i;
-	int nr_w;
-	if(nr_class==2 && model_->param.solver_type != MCSVM_CS)
-		nr_w = 1;
-	else
-		nr_w = nr_class;
+	int nr_w = get_nr_decision_values(model_);
 
-	const feature_node *lx=x;
 	for(i=0;i<nr_w;i++)
 		dec_values[i] = 0;
-	for(; (idx=lx->index)!=-1; lx++)
+	for(; x.valid(); x.next())
 	{
+		idx=x.index();
 		// the dimension of testing data may exceed that of training
 		if(idx<=n)
 			for(i=0;i<nr_w;i++)
-				dec_values[i] += w[(idx-1)*nr_w+i]*lx->value;
+				dec_values[i] += w[(idx-1)*nr_w+i]*x.value();
 	}
 
 	if(nr_class==2)
@@ -2508,11 +4528,43 @@ double predict_values(const struct model *model_, const struct feature_node *x,
 	}
 }
 
+double predict_values(const struct model *model_, const struct feature_node *x, double *dec_values)
+{
+	return predict_row(model_, node_row(x), dec_values);
+}
+
+double predict_binary_values(const struct model *model_, const int *index, double *dec_values)
+{
+	return predict_row(model_, index_row(index), dec_values);
+}
+
+void predict_values_batch(const struct model *model_, const struct problem *prob, int begin, int end,
+	double *dec_values, double *labels, int nr_thread)
+{
+	int nr_w = get_nr_decision_values(model_);
+	int l = end-begin;
+	nr_thread = min(get_nr_thread(nr_thread), max(l, 1));
+
+	run_parallel(nr_thread, [&](int k) {
+		int first = begin+(int)((long)l*k/nr_thread);
+		int last = begin+(int)((long)l*(k+1)/nr_thread);
+		for(int i=first;i<last;i++)
+		{
+			double label = predict_row(model_, node_row(prob->x[i]), &dec_values[(size_t)(i-begin)*nr_w]);
+			if(labels != NULL)
+				labels[i-begin] = label;
+		}
+	});
+}
+
 double predict(const model *model_, const feature_node *x)
 {
-	double *dec_values = Malloc(double, model_->nr_class);
+	// most models have few classes, whose values fit on the stack
+	double buf[16];
+	double *dec_values = (model_->nr_class <= 16)? buf: Malloc(double, model_->nr_class);
 	double label=predict_values(model_, x, dec_values);
-	free(dec_values);
+	if(dec_values != buf)
+		free(dec_values);
 	return label;
 }
 
@@ -2627,6 +4679,9 @@ struct model *load_model(const char *model_file_name)
 	parameter& param = model_->param;
 
 	model_->label = NULL;
+	param.workspace = NULL;
+	param.init_sol = NULL;
+	param.init_alpha = NULL;
 
 	char *old_locale = strdup(setlocale(LC_ALL, NULL));
 	setlocale(LC_ALL, "C");
@@ -2734,6 +4789,14 @@ int get_nr_class(const model *model_)
 	return model_->nr_class;
 }
 
+int get_nr_decision_values(const model *model_)
+{
+	if(model_->nr_class==2 && model_->param.solver_type != MCSVM_CS)
+		return 1;
+	else
+		return model_->nr_class;
+}
+
 void get_labels(const model *model_, int* label)
 {
 	if (model_->label != NULL)
@@ -2759,6 +4822,16 @@ void free_and_destroy_model(struct model **model_ptr_ptr)
 	}
 }
 
+workspace *create_workspace()
+{
+	return new workspace;
+}
+
+void destroy_workspace(workspace *ws)
+{
+	delete ws;
+}
+
 void destroy_param(parameter* param)
 {
 	if(param->weight_label != NULL)
@@ -2778,6 +4851,12 @@ const char *check_parameter(const problem *prob, const parameter *param)
 	if(param->p < 0)
 		return "p < 0";
 
+	if(param->hessian_sample < 0 || param->hessian_sample > 1)
+		return "hessian_sample < 0 or > 1";
+
+	if(param->shuffle_block < 0)
+		return "shuffle_block < 0";
+
 	if(param->solver_type != L2R_LR
 		&& param->solver_type != L2R_L2LOSS_SVC_DUAL
 		&& param->solver_type != L2R_L2LOSS_SVC
@@ -2794,6 +4873,27 @@ const char *check_parameter(const problem *prob, const parameter *param)
 	return NULL;
 }
 
+const char *check_block_parameter(const block_source *src, const parameter *param)
+{
+	problem labels;
+	labels.l = src->l;
+	labels.n = src->n;
+	labels.y = src->y;
+	labels.x = NULL;
+	labels.bias = src->bias;
+
+	const char *error_msg = check_parameter(&labels, param);
+	if(error_msg)
+		return error_msg;
+
+	if(param->solver_type != L2R_L2LOSS_SVC_DUAL
+		&& param->solver_type != L2R_L1LOSS_SVC_DUAL
+		&& param->solver_type != L2R_LR_DUAL)
+		return "training by blocks supports only solvers 1, 3 and 7";
+
+	return NULL;
+}
+
 int check_probability_model(const struct model *model_)
 {
 	return (model_->param.solver_type==L2R_LR ||
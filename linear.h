@@ -21,6 +21,9 @@ struct problem
 
 enum { L2R_LR, L2R_L2LOSS_SVC_DUAL, L2R_L2LOSS_SVC, L2R_L1LOSS_SVC_DUAL, MCSVM_CS, L1R_L2LOSS_SVC, L1R_LR, L2R_LR_DUAL, L2R_L2LOSS_SVR = 11, L2R_L2LOSS_SVR_DUAL, L2R_L1LOSS_SVR_DUAL }; /* solver_type */
 
+/* memory and threads for the solvers, from create_workspace() */
+struct workspace;
+
 struct parameter
 {
 	int solver_type;
@@ -32,6 +35,16 @@ struct parameter
 	int *weight_label;
 	double* weight;
 	double p;
+	int nr_thread;		/* threads for -s 0, 1, 2, 3, 4, 7, 11, 12 and 13; all cores if <= 0 */
+	int by_column;		/* -s 0, 2 and 11 also keep the data by columns */
+	int precondition;	/* -s 0, 2 and 11 precondition CG by the Hessian's diagonal */
+	double hessian_sample;	/* fraction of instances in their Hessian-vector products; 0 or 1 for all */
+	int seed;		/* seed of the solvers' random numbers */
+	int shuffle_block;	/* dual CD shuffles blocks of this many instances, then each block; 0 for one shuffle */
+	struct workspace *workspace;	/* work arrays kept across train() calls, or NULL */
+	double *init_sol;	/* initial w of the primal solvers, as model->w, or NULL */
+	double *init_alpha;	/* initial dual variables of the dual solvers, replaced by
+				   the final ones, or NULL; see README for the layout */
 };
 
 struct model
@@ -44,11 +57,67 @@ struct model
 	double bias;
 };
 
+/* The same data in compressed sparse rows: instance i has the nonzeros
+   (col_idx[k], val[k]) for row_ptr[i] <= k < row_ptr[i+1], with 1-based
+   ascending col_idx as in feature_node and the bias, if any, as column n.
+   There are no sentinels and 12 rather than 16 bytes per nonzero.
+   If val is NULL the values are held in single precision in fval, 8 bytes
+   per nonzero; w and all the sums over them are still computed in double.
+   If fval is NULL too, every value is 1 and only the indices are stored.
+   If col_idx is NULL the indices of instance i are packed in
+   idx_bytes[byte_ptr[i]], ..., idx_bytes[byte_ptr[i+1]-1] as the gaps
+   between them (the first from 0), each a varint of 7 bits per byte, low
+   bits first, with the top bit set on all but its last byte. */
+struct csr_problem
+{
+	int l, n;
+	double *y;
+	long *row_ptr;
+	int *col_idx;
+	double *val;
+	float *fval;
+	long *byte_ptr;
+	unsigned char *idx_bytes;
+	double bias;            /* < 0 if no bias term */
+};
+
+/* A training set read one block of instances at a time, for data too
+   large for memory */
+struct block_source
+{
+	int l, n;
+	double *y;		/* labels of all l instances */
+	double bias;            /* < 0 if no bias term */
+	int nr_block;
+	int *start;		/* block b holds instances start[b], ..., start[b+1]-1 */
+	/* read block b into prob, whose y points into the labels above;
+	   called from a prefetching thread while another block is in use */
+	void (*load_block)(const struct block_source *src, int b, struct problem *prob);
+	void (*free_block)(const struct block_source *src, struct problem *prob);
+	void *data;
+};
+
 struct model* train(const struct problem *prob, const struct parameter *param);
+struct model* train_blocks(const struct block_source *src, const struct parameter *param);
+struct model* train_csr(const struct csr_problem *prob, const struct parameter *param);
+/* train a model for each of C[0] < ... < C[nr_C-1], each solve starting
+   from the solution for the previous C; returns a malloc'ed array of nr_C
+   models, or NULL if C is not increasing and positive */
+struct model** train_path(const struct problem *prob, const struct parameter *param, int nr_C, const double *C);
 void cross_validation(const struct problem *prob, const struct parameter *param, int nr_fold, double *target);
 
 double predict_values(const struct model *model_, const struct feature_node *x, double* dec_values);
+/* predict_values() for an instance whose nonzeros are all 1, given by its
+   indices ended by -1 */
+double predict_binary_values(const struct model *model_, const int *index, double* dec_values);
 double predict(const struct model *model_, const struct feature_node *x);
+/* predict_values() for instances begin, ..., end-1 of prob: those of
+   instance i go to row i-begin of dec_values, get_nr_decision_values()
+   values a row, and its prediction to labels[i-begin] if labels is not
+   NULL. The rows are split among nr_thread threads, all online cores if
+   nr_thread <= 0. */
+void predict_values_batch(const struct model *model_, const struct problem *prob, int begin, int end,
+	double *dec_values, double *labels, int nr_thread);
 double predict_probability(const struct model *model_, const struct feature_node *x, double* prob_estimates);
 
 int save_model(const char *model_file_name, const struct model *model_);
@@ -56,13 +125,31 @@ struct model *load_model(const char *model_file_name);
 
 int get_nr_feature(const struct model *model_);
 int get_nr_class(const struct model *model_);
+/* the number of decision values predict_values() gives: 1 for two classes
+   or regression except with MCSVM_CS, else nr_class */
+int get_nr_decision_values(const struct model *model_);
 void get_labels(const struct model *model_, int* label);
 
 void free_model_content(struct model *model_ptr);
 void free_and_destroy_model(struct model **model_ptr_ptr);
 void destroy_param(struct parameter *param);
 
+struct workspace *create_workspace(void);
+void destroy_workspace(struct workspace *ws);
+
+/* copy prob into csr, to be released by free_csr_problem(); returns 0 on
+   success, -1 if out of memory. If every value in prob is 1 no values are
+   stored. */
+int problem_to_csr(const struct problem *prob, struct csr_problem *csr);
+/* the same with the values rounded to float in csr->fval */
+int problem_to_csr_float(const struct problem *prob, struct csr_problem *csr);
+/* replace csr->col_idx by packed indices; returns 0 on success, -1 if out
+   of memory, in which case csr is unchanged */
+int pack_csr_indices(struct csr_problem *csr);
+void free_csr_problem(struct csr_problem *csr);
+
 const char *check_parameter(const struct problem *prob, const struct parameter *param);
+const char *check_block_parameter(const struct block_source *src, const struct parameter *param);
 int check_probability_model(const struct model *model);
 void set_print_string_function(void (*print_func) (const char*));
 
@@ -0,0 +1,108 @@
+#ifndef _PARALLEL_H
+#define _PARALLEL_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+// The threading helpers of the library and the data reader.
+
+// nr_thread, or all online cores if nr_thread <= 0
+static inline int get_nr_thread(int nr_thread)
+{
+	if(nr_thread <= 0)
+		nr_thread = (int)std::thread::hardware_concurrency();
+	return (nr_thread > 0)? nr_thread: 1;
+}
+
+// run f(0), ..., f(n-1) on n threads, f(0) on the calling one
+template <class F> static void run_parallel(int n, F f)
+{
+	std::vector<std::thread> threads;
+	for(int k=1;k<n;k++)
+		threads.push_back(std::thread(f, k));
+	f(0);
+	for(size_t k=0;k<threads.size();k++)
+		threads[k].join();
+}
+
+// Threads kept for many short parallel regions, such as the products of
+// every CG step or the passes of dual CD, which would otherwise start and
+// join threads each time. run(n, f) runs f(0), ..., f(n-1) as
+// run_parallel() does, f(0) on the calling thread and the rest on
+// workers, which are started as first needed and wait for the next call
+// until the pool is destroyed. One thread at a time may call run().
+class thread_pool
+{
+public:
+	thread_pool(): job(NULL), arg(NULL), nr_job(0), nr_pending(0), round(0), stop(false) {}
+	~thread_pool()
+	{
+		{
+			std::lock_guard<std::mutex> hold(lock);
+			stop = true;
+		}
+		wake.notify_all();
+		for(size_t k=0;k<workers.size();k++)
+			workers[k].join();
+	}
+
+	template <class F> void run(int n, F f)
+	{
+		if(n <= 1)
+		{
+			f(0);
+			return;
+		}
+		while((int)workers.size() < n-1)
+			workers.push_back(std::thread(&thread_pool::work, this, (int)workers.size()+1, round));
+		{
+			std::lock_guard<std::mutex> hold(lock);
+			job = &call<F>;
+			arg = &f;
+			nr_job = n;
+			nr_pending = n-1;
+			round++;
+		}
+		wake.notify_all();
+		f(0);
+		std::unique_lock<std::mutex> hold(lock);
+		done.wait(hold, [this] { return nr_pending == 0; });
+	}
+
+private:
+	template <class F> static void call(void *f, int k) { (*(F *)f)(k); }
+
+	// the loop of worker k, which runs f(k) of each call with n > k after
+	// the seen-th
+	void work(int k, unsigned long seen)
+	{
+		std::unique_lock<std::mutex> hold(lock);
+		while(true)
+		{
+			wake.wait(hold, [&] { return stop || round != seen; });
+			if(stop)
+				return;
+			seen = round;
+			if(k >= nr_job)
+				continue;
+			hold.unlock();
+			job(arg, k);
+			hold.lock();
+			if(--nr_pending == 0)
+				done.notify_one();
+		}
+	}
+
+	std::vector<std::thread> workers;	// worker k+1 in workers[k]
+	std::mutex lock;
+	std::condition_variable wake, done;
+	void (*job)(void *, int);
+	void *arg;
+	int nr_job, nr_pending;
+	unsigned long round;	// calls of run() with n > 1 so far
+	bool stop;
+};
+
+#endif /* _PARALLEL_H */
@@ -4,6 +4,9 @@
 #include <string.h>
 #include <cassert>
 #include <errno.h>
+#include <atomic>
+#include <string>
+#include <thread>
 #include "linear.h"
 #include "eval.h"
 
@@ -52,8 +55,55 @@ void exit_with_help()
 }
 
 
-struct feature_node * x;
-int max_nr_attr = 64;
+// A bounded queue between one producer thread and one consumer thread.
+// It needs no lock: each side owns one index and publishes it with a
+// release store, and a side that finds the queue full or empty yields.
+template <class T> class spsc_queue
+{
+public:
+	spsc_queue(size_t capacity): buf(capacity+1), head(0), tail(0) {}
+
+	void push(T v)
+	{
+		size_t t = tail.load(std::memory_order_relaxed);
+		size_t next = (t+1)%buf.size();
+		while(next == head.load(std::memory_order_acquire))
+			std::this_thread::yield();
+		buf[t] = v;
+		tail.store(next, std::memory_order_release);
+	}
+
+	T pop()
+	{
+		size_t h = head.load(std::memory_order_relaxed);
+		while(h == tail.load(std::memory_order_acquire))
+			std::this_thread::yield();
+		T v = buf[h];
+		head.store((h+1)%buf.size(), std::memory_order_release);
+		return v;
+	}
+
+private:
+	std::vector<T> buf;
+	alignas(64) std::atomic<size_t> head;	// next slot to pop
+	alignas(64) std::atomic<size_t> tail;	// next slot to push
+};
+
+// Instances travel through the pipeline in batches, which are reused once
+// written. A batch of size 0 marks the end of the input.
+#define BATCH_SIZE 1024
+#define NR_BATCH 8
+
+struct batch
+{
+	int size;
+	std::vector<double> target;
+	std::vector<size_t> start;		// instance i begins at x[start[i]]
+	std::vector<feature_node> x;
+	std::vector<double> predict_label;
+	std::vector<double> dec_value;
+	std::vector<double> prob_estimates;	// nr_class per instance for -o 2
+};
 
 struct model * model_;
 int flag_predict_probability = 0;
@@ -113,133 +163,180 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
-	x = (struct feature_node *) malloc(max_nr_attr*sizeof(struct feature_node));
 	do_predict(input, output);
 	free_and_destroy_model(&model_);
 	free(line);
-	free(x);
 	fclose(input);
 	fclose(output);
 	return 0;
 }
 
+// parse line, instance number line_num, into the end of b
+static void parse_instance(char *line, int line_num, int nr_feature, batch *b)
+{
+	char *idx, *val, *label, *endptr;
+	int inst_max_index = 0; // strtol gives 0 if wrong format
+	feature_node node;
+
+	label = strtok(line," \t\n");
+	if(label == NULL) // empty line
+		exit_input_error(line_num);
+
+	b->target.push_back(strtod(label,&endptr));
+	if(endptr == label || *endptr != '\0')
+		exit_input_error(line_num);
+
+	b->start.push_back(b->x.size());
+	while(1)
+	{
+		idx = strtok(NULL,":");
+		val = strtok(NULL," \t");
+
+		if(val == NULL)
+			break;
+		errno = 0;
+		node.index = (int) strtol(idx,&endptr,10);
+		if(endptr == idx || errno != 0 || *endptr != '\0' || node.index <= inst_max_index)
+			exit_input_error(line_num);
+		else
+			inst_max_index = node.index;
+
+		errno = 0;
+		node.value = strtod(val,&endptr);
+		if(endptr == val || errno != 0 || (*endptr != '\0' && !isspace(*endptr)))
+			exit_input_error(line_num);
+
+		// feature indices larger than those in training are not used
+		if(node.index <= nr_feature)
+			b->x.push_back(node);
+	}
+
+	if(model_->bias>=0)
+	{
+		node.index = nr_feature+1;
+		node.value = model_->bias;
+		b->x.push_back(node);
+	}
+	node.index = -1;
+	b->x.push_back(node);
+	b->size++;
+}
+
+// first stage: read and parse the input into batches
+static void read_batches(FILE *input, spsc_queue<batch *> *free_batches, spsc_queue<batch *> *parsed)
+{
+	int nr_feature = get_nr_feature(model_);
+	int total = 0;
+	batch *b;
+
+	max_line_len = 1024;
+	line = (char *)malloc(max_line_len*sizeof(char));
+	do
+	{
+		b = free_batches->pop();
+		b->size = 0;
+		b->target.clear();
+		b->start.clear();
+		b->x.clear();
+		while(b->size < BATCH_SIZE && readline(input) != NULL)
+			parse_instance(line, ++total, nr_feature, b);
+		parsed->push(b);
+	} while(b->size > 0);
+}
+
+// second stage: score the instances of each batch
+static void score_batches(spsc_queue<batch *> *parsed, spsc_queue<batch *> *scored)
+{
+	int nr_class = get_nr_class(model_);
+	batch *b;
+
+	do
+	{
+		b = parsed->pop();
+		b->predict_label.resize(b->size);
+		b->dec_value.resize(b->size);
+		if(output_option==2)
+			b->prob_estimates.resize((size_t)b->size*nr_class);
+		for(int i=0;i<b->size;i++)
+		{
+			const feature_node *x = &b->x[b->start[i]];
+			b->predict_label[i] = predict_values(model_, x, &b->dec_value[i]);
+			if(output_option==2)
+				b->predict_label[i] = predict_probability(model_, x, &b->prob_estimates[(size_t)i*nr_class]);
+		}
+		scored->push(b);
+	} while(b->size > 0);
+}
+
+// third stage: format the results of each batch with a single write, and
+// keep them for evaluating model performance
+static void write_batches(FILE *output, spsc_queue<batch *> *scored, spsc_queue<batch *> *free_batches,
+	dvec_t *pred_values, dvec_t *true_values)
+{
+	int nr_class = get_nr_class(model_);
+	std::string out;
+	char buf[64];
+	batch *b;
+
+	while((b = scored->pop())->size > 0)
+	{
+		out.clear();
+		for(int i=0;i<b->size;i++)
+		{
+			if(output_option==0)
+				out.append(buf, (size_t)snprintf(buf, sizeof(buf), "%g\n", b->predict_label[i]));
+			else if(output_option==1)
+				out.append(buf, (size_t)snprintf(buf, sizeof(buf), "%g\n", b->dec_value[i]));
+			else if(output_option==2)
+			{
+				out.append(buf, (size_t)snprintf(buf, sizeof(buf), "%g", b->predict_label[i]));
+				for(int j=0;j<nr_class;j++)
+					out.append(buf, (size_t)snprintf(buf, sizeof(buf), " %g", b->prob_estimates[(size_t)i*nr_class+j]));
+				out += '\n';
+			}
+
+			pred_values->push_back(b->dec_value[i]);
+			true_values->push_back((b->target[i]==model_->label[0])?(+1):(-1));
+		}
+		fwrite(out.data(), 1, out.size(), output);
+		free_batches->push(b);
+	}
+}
 
+// Reading and parsing, scoring, and formatting the output run as a
+// pipeline of three threads passing batches of instances through bounded
+// queues, so none of them waits for the others' I/O.
 void do_predict(FILE *input, FILE *output)
 {
-    std::vector<double> pred_values; //store decision values
-    std::vector<double> true_values; //store true values
+    dvec_t pred_values; //store decision values
+    dvec_t true_values; //store true values
 
-	int total = 0;
 	int nr_class = get_nr_class(model_);
 	int * labels = Malloc(int, nr_class);
     get_labels(model_, labels);
-	double * prob_estimates = NULL;
-	int j, n;
-	int nr_feature = get_nr_feature(model_);
-	if(model_->bias >=0)
-		n = nr_feature+1;
-	else
-		n = nr_feature;
+	int j;
 
     // not yet support multiclass
     assert(nr_class==2);
 
     //print out header...
     if(output_option ==2) {
-		prob_estimates = Malloc(double, nr_class);
 		fprintf(output,"labels");
 		for(j=0;j<nr_class;j++)
 			fprintf(output," %d",labels[j]);
 		fprintf(output,"\n");
     }
 
-	max_line_len = 1024;
-	line = (char *)malloc(max_line_len*sizeof(char));
-	while(readline(input) != NULL)
-	{
-		int i = 0;
-		double target_label, predict_label;
-		char *idx, *val, *label, *endptr;
-		int inst_max_index = 0; // strtol gives 0 if wrong format
-
-		label = strtok(line," \t\n");
-		if(label == NULL) // empty line
-			exit_input_error(total+1);
-
-		target_label = strtod(label,&endptr);
-		if(endptr == label || *endptr != '\0')
-			exit_input_error(total+1);
-
-		while(1)
-		{
-			if(i>=max_nr_attr-2)	// need one more for index = -1
-			{
-				max_nr_attr *= 2;
-				x = (struct feature_node *) realloc(x,max_nr_attr*sizeof(struct feature_node));
-			}
+	std::vector<batch> batches(NR_BATCH);
+	spsc_queue<batch *> free_batches(NR_BATCH), parsed(NR_BATCH), scored(NR_BATCH);
+	for(j=0;j<NR_BATCH;j++)
+		free_batches.push(&batches[j]);
 
-			idx = strtok(NULL,":");
-			val = strtok(NULL," \t");
-
-			if(val == NULL)
-				break;
-			errno = 0;
-			x[i].index = (int) strtol(idx,&endptr,10);
-			if(endptr == idx || errno != 0 || *endptr != '\0' || x[i].index <= inst_max_index)
-				exit_input_error(total+1);
-			else
-				inst_max_index = x[i].index;
-
-			errno = 0;
-			x[i].value = strtod(val,&endptr);
-			if(endptr == val || errno != 0 || (*endptr != '\0' && !isspace(*endptr)))
-				exit_input_error(total+1);
-
-			// feature indices larger than those in training are not used
-			if(x[i].index <= nr_feature)
-				++i;
-		}
-
-		if(model_->bias>=0)
-		{
-			x[i].index = n;
-			x[i].value = model_->bias;
-			i++;
-		}
-		x[i].index = -1;
-
-        //XXX
-        double dec_value;
-        predict_label = predict_values(model_, x, &dec_value);
-
-        if(output_option==0) {
-		    //predict_label = predict(model_, x);
-			fprintf(output,"%g\n", predict_label);
-        }
-        else if(output_option==1) {
-			fprintf(output,"%g\n", dec_value);
-        }
-        else if(output_option==2) {
-//            if(target_label==model_->label[0]) {
-//			    fprintf(output,"%g %g\n", predict_label,1.0/(1.0+exp(-dec_value)) );
-//            }
-//            else {
-//			    fprintf(output,"%g %g\n", predict_label,1.0/(1.0+exp(-(1-dec_value))) );
-//            }
-			predict_label = predict_probability(model_, x, prob_estimates);
-			fprintf(output,"%g", predict_label);
-			for(j=0;j<nr_class;j++)
-				fprintf(output," %g",prob_estimates[j]);
-			fprintf(output,"\n");
-        }
-        else {
-            //unexpected output option
-        }
-
-        // store for evaluating model performance
-        pred_values.push_back( dec_value );
-        true_values.push_back( (target_label==model_->label[0])?(+1):(-1) );
-	}
+	std::thread reader(read_batches, input, &free_batches, &parsed);
+	std::thread writer(write_batches, output, &scored, &free_batches, &pred_values, &true_values);
+	score_batches(&parsed, &scored);
+	reader.join();
+	writer.join();
 
 	if(model_->param.solver_type==L2R_L2LOSS_SVR ||
 	   model_->param.solver_type==L2R_L1LOSS_SVR_DUAL ||
@@ -253,9 +350,4 @@ void do_predict(FILE *input, FILE *output)
     }
 
 	free(labels);
-
-//	if(flag_predict_probability)
-	if(output_option==2)
-		free(prob_estimates);
-
 }
@@ -0,0 +1,47 @@
+#ifndef _RNG_H
+#define _RNG_H
+
+#include <stdint.h>
+
+// xoshiro256** (Blackman and Vigna, 2018), started by splitmix64 from a
+// seed. It is a few instructions a number, keeps its state in the object
+// rather than in libc, and gives the same numbers for the same seed on
+// every platform. It has no constructor so that it may be thread_local
+// at no cost; seed() it before use.
+struct rng
+{
+	uint64_t s[4];
+
+	void seed(uint64_t x)
+	{
+		for(int k=0;k<4;k++)
+		{
+			uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+			s[k] = z ^ (z >> 31);
+		}
+	}
+
+	uint64_t next()
+	{
+		uint64_t r = rotl(s[1]*5, 7)*9;
+		uint64_t t = s[1] << 17;
+		s[2] ^= s[0];
+		s[3] ^= s[1];
+		s[1] ^= s[2];
+		s[0] ^= s[3];
+		s[2] ^= t;
+		s[3] = rotl(s[3], 45);
+		return r;
+	}
+
+	// a number in 0, ..., n-1 for n > 0, by a multiply and a shift
+	// (Lemire, 2019) instead of a division; its bias, under n/2^32, is
+	// far below what a shuffle can show
+	int uniform(int n) { return (int)(((next() >> 32)*(uint64_t)n) >> 32); }
+
+	static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64-k)); }
+};
+
+#endif /* _RNG_H */
@@ -5,6 +5,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include "linear.h"
+#include "dataset.h"
 #include "eval.h"
 #include "common.h"
 
@@ -48,40 +49,22 @@ void exit_with_help()
 	"-B bias : if bias >= 0, instance x becomes [x; bias]; if < 0, no bias term added (default -1)\n"
 	"-wi weight: weights adjust the parameter C of different classes (see README for details)\n"
 	"-v n: n-fold cross validation mode\n"
+	"-n nr_thread : number of threads for -s 0, 1, 2, 3, 4, 7, 11, 12 and 13, 0 for all cores (default 1)\n"
+	"-x by_column : for -s 0, 2 and 11, 1 to also keep the data by columns, which\n"
+	"	takes twice the memory but speeds up X^T v (default 0)\n"
+	"-P precondition : for -s 0, 2 and 11, 1 to precondition CG by the diagonal\n"
+	"	of the Hessian, which takes fewer CG steps on ill-conditioned problems (default 0)\n"
+	"-H fraction : for -s 0, 2 and 11, compute the Hessian-vector products of CG on a\n"
+	"	random sample of this fraction of the instances, drawn at each Newton step (default 1)\n"
+	"-r seed : seed of the random numbers of the solvers and of cross validation (default 0)\n"
+	"-O block : for -s 1, 3, 7, 12 and 13, visit the instances of each pass in shuffled blocks\n"
+	"	of this many consecutive instances, each shuffled in turn (default 0, one shuffle)\n"
 	"-q : quiet mode (no outputs)\n"
 	);
 	exit(1);
 }
 
-void exit_input_error(int line_num)
-{
-	fprintf(stderr,"Wrong input format at line %d\n", line_num);
-	exit(1);
-}
-
-static char *line = NULL;
-static int max_line_len;
-
-static char* readline(FILE *input)
-{
-	int len;
-
-	if(fgets(line,max_line_len,input) == NULL)
-		return NULL;
-
-	while(strrchr(line,'\n') == NULL)
-	{
-		max_line_len *= 2;
-		line = (char *) realloc(line,max_line_len);
-		len = (int) strlen(line);
-		if(fgets(line+len,max_line_len-len,input) == NULL)
-			break;
-	}
-	return line;
-}
-
 void parse_command_line(int argc, char **argv, char *input_file_name, char *model_file_name);
-void read_problem(const char *filename);
 void do_cross_validation();
 
 
@@ -100,7 +83,7 @@ int main(int argc, char **argv)
 	const char *error_msg;
 
 	parse_command_line(argc, argv, input_file_name, model_file_name);
-	read_problem(input_file_name);
+	x_space = read_problem(input_file_name, bias, 0, &prob);
 	error_msg = check_parameter(&prob,&param);
 
 	if(error_msg)
@@ -135,10 +118,7 @@ int main(int argc, char **argv)
 		free_and_destroy_model(&model_);
 	}
 	destroy_param(&param);
-	free(prob.y);
-	free(prob.x);
-	free(x_space);
-	free(line);
+	free_problem(&prob, x_space);
 
 	return 0;
 }
@@ -197,6 +177,15 @@ void parse_command_line(int argc, char **argv, char *input_file_name, char *mode
 	param.nr_weight = 0;
 	param.weight_label = NULL;
 	param.weight = NULL;
+	param.nr_thread = 1;
+	param.by_column = 0;
+	param.precondition = 0;
+	param.hessian_sample = 1;
+	param.seed = 0;
+	param.shuffle_block = 0;
+	param.workspace = NULL;
+	param.init_sol = NULL;
+	param.init_alpha = NULL;
 	flag_cross_validation = 0;
 	bias = -1;
 
@@ -236,6 +225,30 @@ void parse_command_line(int argc, char **argv, char *input_file_name, char *mode
 				param.weight[param.nr_weight-1] = atof(argv[i]);
 				break;
 
+			case 'n':
+				param.nr_thread = atoi(argv[i]);
+				break;
+
+			case 'x':
+				param.by_column = atoi(argv[i]);
+				break;
+
+			case 'P':
+				param.precondition = atoi(argv[i]);
+				break;
+
+			case 'H':
+				param.hessian_sample = atof(argv[i]);
+				break;
+
+			case 'r':
+				param.seed = atoi(argv[i]);
+				break;
+
+			case 'O':
+				param.shuffle_block = atoi(argv[i]);
+				break;
+
 			case 'v':
 				flag_cross_validation = 1;
 				nr_fold = atoi(argv[i]);
@@ -306,105 +319,3 @@ void parse_command_line(int argc, char **argv, char *input_file_name, char *mode
 		}
 	}
 }
-
-// read in a problem (in libsvm format)
-void read_problem(const char *filename)
-{
-	int max_index, inst_max_index, i;
-	long int elements, j;
-	FILE *fp = fopen(filename,"r");
-	char *endptr;
-	char *idx, *val, *label;
-
-	if(fp == NULL)
-	{
-		fprintf(stderr,"can't open input file %s\n",filename);
-		exit(1);
-	}
-
-	prob.l = 0;
-	elements = 0;
-	max_line_len = 1024;
-	line = Malloc(char,max_line_len);
-	while(readline(fp)!=NULL)
-	{
-		char *p = strtok(line," \t"); // label
-
-		// features
-		while(1)
-		{
-			p = strtok(NULL," \t");
-			if(p == NULL || *p == '\n') // check '\n' as ' ' may be after the last feature
-				break;
-			elements++;
-		}
-		elements++; // for bias term
-		prob.l++;
-	}
-	rewind(fp);
-
-	prob.bias=bias;
-
-	prob.y = Malloc(double,prob.l);
-	prob.x = Malloc(struct feature_node *,prob.l);
-	x_space = Malloc(struct feature_node,elements+prob.l);
-
-	max_index = 0;
-	j=0;
-	for(i=0;i<prob.l;i++)
-	{
-		inst_max_index = 0; // strtol gives 0 if wrong format
-		readline(fp);
-		prob.x[i] = &x_space[j];
-		label = strtok(line," \t\n");
-		if(label == NULL) // empty line
-			exit_input_error(i+1);
-
-		prob.y[i] = strtod(label,&endptr);
-		if(endptr == label || *endptr != '\0')
-			exit_input_error(i+1);
-
-		while(1)
-		{
-			idx = strtok(NULL,":");
-			val = strtok(NULL," \t");
-
-			if(val == NULL)
-				break;
-
-			errno = 0;
-			x_space[j].index = (int) strtol(idx,&endptr,10);
-			if(endptr == idx || errno != 0 || *endptr != '\0' || x_space[j].index <= inst_max_index)
-				exit_input_error(i+1);
-			else
-				inst_max_index = x_space[j].index;
-
-			errno = 0;
-			x_space[j].value = strtod(val,&endptr);
-			if(endptr == val || errno != 0 || (*endptr != '\0' && !isspace(*endptr)))
-				exit_input_error(i+1);
-
-			++j;
-		}
-
-		if(inst_max_index > max_index)
-			max_index = inst_max_index;
-
-		if(prob.bias >= 0)
-			x_space[j++].value = prob.bias;
-
-		x_space[j++].index = -1;
-	}
-
-	if(prob.bias >= 0)
-	{
-		prob.n=max_index+1;
-		for(i=1;i<prob.l;i++)
-			(prob.x[i]-2)->index = prob.n;
-		x_space[j-2].index = prob.n;
-	}
-	else
-		prob.n=max_index;
-
-	fclose(fp);
-}
@@ -5,6 +5,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include "linear.h"
+#include "dataset.h"
 #define Malloc(type,n) (type *)malloc((n)*sizeof(type))
 #define INF HUGE_VAL
 
@@ -49,41 +50,34 @@ void exit_with_help()
 	"-B bias : if bias >= 0, instance x becomes [x; bias]; if < 0, no bias term added (default -1)\n"
 	"-wi weight: weights adjust the parameter C of different classes (see README for details)\n"
 	"-v n: n-fold cross validation mode\n"
+	"-n nr_thread : number of threads for -s 0, 1, 2, 3, 4, 7, 11, 12 and 13, 0 for all cores (default 1)\n"
+	"-x by_column : for -s 0, 2 and 11, 1 to also keep the data by columns, which\n"
+	"	takes twice the memory but speeds up X^T v (default 0)\n"
+	"-P precondition : for -s 0, 2 and 11, 1 to precondition CG by the diagonal\n"
+	"	of the Hessian, which takes fewer CG steps on ill-conditioned problems (default 0)\n"
+	"-H fraction : for -s 0, 2 and 11, compute the Hessian-vector products of CG on a\n"
+	"	random sample of this fraction of the instances, drawn at each Newton step (default 1)\n"
+	"-r seed : seed of the random numbers of the solvers and of cross validation (default 0)\n"
+	"-O block : for -s 1, 3, 7, 12 and 13, visit the instances of each pass in shuffled blocks\n"
+	"	of this many consecutive instances, each shuffled in turn (default 0, one shuffle)\n"
+	"-D layout : storage of the data during training\n"
+	"	0 -- feature_node rows (default)\n"
+	"	1 -- CSR arrays, 12 rather than 16 bytes per nonzero\n"
+	"	2 -- CSR arrays with float values, 8 bytes per nonzero\n"
+	"	3 -- as 1, with the indices delta-encoded, about 1 byte each\n"
+	"	4 -- as 2, with the indices delta-encoded\n"
+	"	with 1 to 4, no values are kept if every value is 1\n"
+	"-M block_mb : train out of core, reading training_set_file, a binary cache\n"
+	"	made by cache-convert, in blocks of about block_mb MB (-s 1, 3 and 7)\n"
 	"-q : quiet mode (no outputs)\n"
 	);
 	exit(1);
 }
 
-void exit_input_error(int line_num)
-{
-	fprintf(stderr,"Wrong input format at line %d\n", line_num);
-	exit(1);
-}
-
-static char *line = NULL;
-static int max_line_len;
-
-static char* readline(FILE *input)
-{
-	int len;
-
-	if(fgets(line,max_line_len,input) == NULL)
-		return NULL;
-
-	while(strrchr(line,'\n') == NULL)
-	{
-		max_line_len *= 2;
-		line = (char *) realloc(line,max_line_len);
-		len = (int) strlen(line);
-		if(fgets(line+len,max_line_len-len,input) == NULL)
-			break;
-	}
-	return line;
-}
-
 void parse_command_line(int argc, char **argv, char *input_file_name, char *model_file_name);
-void read_problem(const char *filename);
 void do_cross_validation();
+void do_train_blocks(const char *input_file_name, const char *model_file_name);
+void do_train_csr(const char *model_file_name);
 
 struct feature_node *x_space;
 struct parameter param;
@@ -92,6 +86,8 @@ struct model* model_;
 int flag_cross_validation;
 int nr_fold;
 double bias;
+double block_mb;
+int layout;
 
 int main(int argc, char **argv)
 {
@@ -100,7 +96,12 @@ int main(int argc, char **argv)
 	const char *error_msg;
 
 	parse_command_line(argc, argv, input_file_name, model_file_name);
-	read_problem(input_file_name);
+	if(block_mb > 0)
+	{
+		do_train_blocks(input_file_name, model_file_name);
+		return 0;
+	}
+	x_space = read_problem(input_file_name, bias, 0, &prob);
 	error_msg = check_parameter(&prob,&param);
 
 	if(error_msg)
@@ -113,6 +114,12 @@ int main(int argc, char **argv)
 	{
 		do_cross_validation();
 	}
+	else if(layout != 0)
+	{
+		do_train_csr(model_file_name);
+		destroy_param(&param);
+		return 0;
+	}
 	else
 	{
 		model_=train(&prob, &param);
@@ -124,10 +131,7 @@ int main(int argc, char **argv)
 		free_and_destroy_model(&model_);
 	}
 	destroy_param(&param);
-	free(prob.y);
-	free(prob.x);
-	free(x_space);
-	free(line);
+	free_problem(&prob, x_space);
 
 	return 0;
 }
@@ -173,6 +177,58 @@ void do_cross_validation()
 	free(target);
 }
 
+void do_train_csr(const char *model_file_name)
+{
+	struct csr_problem csr;
+	int ret;
+
+	if(layout == 2 || layout == 4)
+		ret = problem_to_csr_float(&prob, &csr);
+	else
+		ret = problem_to_csr(&prob, &csr);
+	if(ret == 0 && layout >= 3)
+		ret = pack_csr_indices(&csr);
+	if(ret)
+	{
+		fprintf(stderr,"can't allocate memory for the CSR arrays\n");
+		exit(1);
+	}
+	free_problem(&prob, x_space);
+
+	model_=train_csr(&csr, &param);
+	if(save_model(model_file_name, model_))
+	{
+		fprintf(stderr,"can't save model to file %s\n",model_file_name);
+		exit(1);
+	}
+	free_and_destroy_model(&model_);
+	free_csr_problem(&csr);
+}
+
+void do_train_blocks(const char *input_file_name, const char *model_file_name)
+{
+	struct block_source src;
+	const char *error_msg;
+
+	open_block_source(input_file_name, bias, (size_t)(block_mb*1024*1024), &src);
+	error_msg = check_block_parameter(&src,&param);
+	if(error_msg)
+	{
+		fprintf(stderr,"ERROR: %s\n",error_msg);
+		exit(1);
+	}
+
+	model_=train_blocks(&src, &param);
+	if(save_model(model_file_name, model_))
+	{
+		fprintf(stderr,"can't save model to file %s\n",model_file_name);
+		exit(1);
+	}
+	free_and_destroy_model(&model_);
+	destroy_param(&param);
+	close_block_source(&src);
+}
+
 void parse_command_line(int argc, char **argv, char *input_file_name, char *model_file_name)
 {
 	int i;
@@ -186,8 +242,19 @@ void parse_command_line(int argc, char **argv, char *input_file_name, char *mode
 	param.nr_weight = 0;
 	param.weight_label = NULL;
 	param.weight = NULL;
+	param.nr_thread = 1;
+	param.by_column = 0;
+	param.precondition = 0;
+	param.hessian_sample = 1;
+	param.seed = 0;
+	param.shuffle_block = 0;
+	param.workspace = NULL;
+	param.init_sol = NULL;
+	param.init_alpha = NULL;
 	flag_cross_validation = 0;
 	bias = -1;
+	block_mb = 0;
+	layout = 0;
 
 	// parse options
 	for(i=1;i<argc;i++)
@@ -225,6 +292,30 @@ void parse_command_line(int argc, char **argv, char *input_file_name, char *mode
 				param.weight[param.nr_weight-1] = atof(argv[i]);
 				break;
 
+			case 'n':
+				param.nr_thread = atoi(argv[i]);
+				break;
+
+			case 'x':
+				param.by_column = atoi(argv[i]);
+				break;
+
+			case 'P':
+				param.precondition = atoi(argv[i]);
+				break;
+
+			case 'H':
+				param.hessian_sample = atof(argv[i]);
+				break;
+
+			case 'r':
+				param.seed = atoi(argv[i]);
+				break;
+
+			case 'O':
+				param.shuffle_block = atoi(argv[i]);
+				break;
+
 			case 'v':
 				flag_cross_validation = 1;
 				nr_fold = atoi(argv[i]);
@@ -235,6 +326,19 @@ void parse_command_line(int argc, char **argv, char *input_file_name, char *mode
 				}
 				break;
 
+			case 'D':
+				layout = atoi(argv[i]);
+				if(layout < 0 || layout > 4)
+				{
+					fprintf(stderr,"unknown layout %d\n", layout);
+					exit_with_help();
+				}
+				break;
+
+			case 'M':
+				block_mb = atof(argv[i]);
+				break;
+
 			case 'q':
 				print_func = &print_null;
 				i--;
@@ -249,6 +353,17 @@ void parse_command_line(int argc, char **argv, char *input_file_name, char *mode
 
 	set_print_string_function(print_func);
 
+	if(block_mb > 0 && flag_cross_validation)
+	{
+		fprintf(stderr,"cross validation is not available with -M\n");
+		exit_with_help();
+	}
+	if(layout != 0 && (flag_cross_validation || block_mb > 0))
+	{
+		fprintf(stderr,"-D is not available with -v or -M\n");
+		exit_with_help();
+	}
+
 	// determine filenames
 	if(i>=argc)
 		exit_with_help();
@@ -295,105 +410,3 @@ void parse_command_line(int argc, char **argv, char *input_file_name, char *mode
 		}
 	}
 }
-
-// read in a problem (in libsvm format)
-void read_problem(const char *filename)
-{
-	int max_index, inst_max_index, i;
-	long int elements, j;
-	FILE *fp = fopen(filename,"r");
-	char *endptr;
-	char *idx, *val, *label;
-
-	if(fp == NULL)
-	{
-		fprintf(stderr,"can't open input file %s\n",filename);
-		exit(1);
-	}
-
-	prob.l = 0;
-	elements = 0;
-	max_line_len = 1024;
-	line = Malloc(char,max_line_len);
-	while(readline(fp)!=NULL)
-	{
-		char *p = strtok(line," \t"); // label
-
-		// features
-		while(1)
-		{
-			p = strtok(NULL," \t");
-			if(p == NULL || *p == '\n') // check '\n' as ' ' may be after the last feature
-				break;
-			elements++;
-		}
-		elements++; // for bias term
-		prob.l++;
-	}
-	rewind(fp);
-
-	prob.bias=bias;
-
-	prob.y = Malloc(double,prob.l);
-	prob.x = Malloc(struct feature_node *,prob.l);
-	x_space = Malloc(struct feature_node,elements+prob.l);
-
-	max_index = 0;
-	j=0;
-	for(i=0;i<prob.l;i++)
-	{
-		inst_max_index = 0; // strtol gives 0 if wrong format
-		readline(fp);
-		prob.x[i] = &x_space[j];
-		label = strtok(line," \t\n");
-		if(label == NULL) // empty line
-			exit_input_error(i+1);
-
-		prob.y[i] = strtod(label,&endptr);
-		if(endptr == label || *endptr != '\0')
-			exit_input_error(i+1);
-
-		while(1)
-		{
-			idx = strtok(NULL,":");
-			val = strtok(NULL," \t");
-
-			if(val == NULL)
-				break;
-
-			errno = 0;
-			x_space[j].index = (int) strtol(idx,&endptr,10);
-			if(endptr == idx || errno != 0 || *endptr != '\0' || x_space[j].index <= inst_max_index)
-				exit_input_error(i+1);
-			else
-				inst_max_index = x_space[j].index;
-
-			errno = 0;
-			x_space[j].value = strtod(val,&endptr);
-			if(endptr == val || errno != 0 || (*endptr != '\0' && !isspace(*endptr)))
-				exit_input_error(i+1);
-
-			++j;
-		}
-
-		if(inst_max_index > max_index)
-			max_index = inst_max_index;
-
-		if(prob.bias >= 0)
-			x_space[j++].value = prob.bias;
-
-		x_space[j++].index = -1;
-	}
-
-	if(prob.bias >= 0)
-	{
-		prob.n=max_index+1;
-		for(i=1;i<prob.l;i++)
-			(prob.x[i]-2)->index = prob.n;
-		x_space[j-2].index = prob.n;
-	}
-	else
-		prob.n=max_index;
-
-	fclose(fp);
-}
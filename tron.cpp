@@ -18,13 +18,119 @@ extern "C" {
 
 extern double dnrm2_(int *, double *, int *);
 extern double ddot_(int *, double *, int *, double *, int *);
-extern int daxpy_(int *, double *, double *, int *, double *, int *);
-extern int dscal_(int *, double *, double *, int *);
 
 #ifdef __cplusplus
 }
 #endif
 
+// The trust region and the inner products of CG are in the norm
+// ||x||_M = sqrt(x'Mx) of a diagonal M. Without preconditioning M is the
+// identity; with it, M approximates the Hessian's diagonal and CG runs
+// on M^{-1/2} H M^{-1/2}, which is better conditioned when the features
+// differ widely in scale or C is large.
+class unit_metric
+{
+public:
+	void update(function *) {}
+	double mul(int, double x) const { return x; }
+	double div(int, double x) const { return x; }
+	double norm(int n, double *x) const
+	{
+		int inc = 1;
+		return dnrm2_(&n, x, &inc);
+	}
+};
+
+class diag_metric
+{
+public:
+	diag_metric(int n, double *M): n(n), M(M) {}
+	// M = (1-a)I + a diag(H) for the current Hessian H; the small weight
+	// a keeps M from straying too far from the identity (Hsia, Chiang and
+	// Lin, ACML 2018)
+	void update(function *fun_obj)
+	{
+		const double a = 0.01;
+		fun_obj->get_diag_preconditioner(M);
+		for (int i=0; i<n; i++)
+			M[i] = (1-a) + a*M[i];
+	}
+	double mul(int i, double x) const { return M[i]*x; }
+	double div(int i, double x) const { return x/M[i]; }
+	double norm(int, double *x) const
+	{
+		double sum = 0;
+		for (int i=0; i<n; i++)
+			sum += M[i]*x[i]*x[i];
+		return sqrt(sum);
+	}
+
+private:
+	int n;
+	double *M;
+};
+
+// Fused vector kernels for tron() and trcg(): each makes one pass over
+// its vectors where the BLAS calls they replace made two or three, which
+// is what counts once n is too large for the vectors to stay in cache.
+// The weight W(i, x) is M[i]*x or x/M[i] for the norms above.
+
+// y += a*x; returns y'W(y)
+template <class W> static double axpy_sqnorm(int n, double a, const double *x, double *y, W weight)
+{
+	double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+	int i;
+	for (i=0; i+4<=n; i+=4)
+	{
+		y[i] += a*x[i];
+		y[i+1] += a*x[i+1];
+		y[i+2] += a*x[i+2];
+		y[i+3] += a*x[i+3];
+		s0 += weight(i, y[i])*y[i];
+		s1 += weight(i+1, y[i+1])*y[i+1];
+		s2 += weight(i+2, y[i+2])*y[i+2];
+		s3 += weight(i+3, y[i+3])*y[i+3];
+	}
+	for (; i<n; i++)
+	{
+		y[i] += a*x[i];
+		s0 += weight(i, y[i])*y[i];
+	}
+	return (s0+s1)+(s2+s3);
+}
+
+// y += a*x; returns y'W(x), y'W(y) and x'W(x)
+template <class W> static void axpy_dots(int n, double a, const double *x, double *y, W weight, double *yx, double *yy, double *xx)
+{
+	double s0 = 0, s1 = 0, s2 = 0;
+	for (int i=0; i<n; i++)
+	{
+		y[i] += a*x[i];
+		double wy = weight(i, y[i]);
+		s0 += wy*x[i];
+		s1 += wy*y[i];
+		s2 += weight(i, x[i])*x[i];
+	}
+	*yx = s0;
+	*yy = s1;
+	*xx = s2;
+}
+
+// x'*y, x'*z and x'W(x)
+template <class W> static void dots(int n, const double *x, const double *y, const double *z, W weight, double *xy, double *xz, double *xx)
+{
+	double s0 = 0, s1 = 0, s2 = 0;
+	for (int i=0; i<n; i++)
+	{
+		s0 += x[i]*y[i];
+		s1 += x[i]*z[i];
+		s2 += weight(i, x[i])*x[i];
+	}
+	*xy = s0;
+	*xz = s1;
+	*xx = s2;
+}
+
 static void default_print(const char *buf)
 {
 	fputs(buf,stdout);
@@ -41,11 +147,13 @@ void TRON::info(const char *fmt,...)
 	(*tron_print_string)(buf);
 }
 
-TRON::TRON(const function *fun_obj, double eps, int max_iter)
+TRON::TRON(const function *fun_obj, double eps, int max_iter, double *work, bool precondition)
 {
 	this->fun_obj=const_cast<function *>(fun_obj);
 	this->eps=eps;
 	this->max_iter=max_iter;
+	this->work=work;
+	this->precondition=precondition;
 	tron_print_string = default_print;
 }
 
@@ -54,6 +162,26 @@ TRON::~TRON()
 }
 
 void TRON::tron(double *w)
+{
+	int n = fun_obj->get_nr_variable();
+	double *buf = (work != NULL)? work: new double[7*n];
+
+	if (precondition)
+	{
+		diag_metric M(n, buf+6*n);
+		solve(w, M, buf);
+	}
+	else
+	{
+		unit_metric M;
+		solve(w, M, buf);
+	}
+
+	if(buf != work)
+		delete[] buf;
+}
+
+template <class Metric> void TRON::solve(double *w, Metric &M, double *buf)
 {
 	// Parameters for updating the iterates.
 	double eta0 = 1e-4, eta1 = 0.25, eta2 = 0.75;
@@ -63,22 +191,38 @@ void TRON::tron(double *w)
 
 	int n = fun_obj->get_nr_variable();
 	int i, cg_iter;
-	double delta, snorm, one=1.0;
-	double alpha, f, fnew, prered, actred, gs;
+	double delta, snorm;
+	double alpha, f, fnew, prered, actred, gs, sr, ss;
 	int search = 1, iter = 1, inc = 1;
-	double *s = new double[n];
-	double *r = new double[n];
-	double *w_new = new double[n];
-	double *g = new double[n];
-
+	double *s = buf;
+	double *r = buf+n;
+	double *w_new = buf+2*n;
+	double *g = buf+3*n;
+	double *d = buf+4*n;	// for trcg
+	double *Hd = buf+5*n;
+	auto mul = [&](int j, double x) { return M.mul(j, x); };
+
+	// The stopping tolerance is relative to the gradient at w = 0, also
+	// when the search starts from a given w; w_new is free until the loop.
+	double gnorm1 = -1;
 	for (i=0; i<n; i++)
-		w[i] = 0;
+		if (w[i] != 0)
+			break;
+	if (i < n)
+	{
+		memset(w_new, 0, sizeof(double)*n);
+		fun_obj->fun(w_new);
+		fun_obj->grad(w_new, g);
+		gnorm1 = dnrm2_(&n, g, &inc);
+	}
 
         f = fun_obj->fun(w);
 	fun_obj->grad(w, g);
-	delta = dnrm2_(&n, g, &inc);
-	double gnorm1 = delta;
-	double gnorm = gnorm1;
+	M.update(fun_obj);
+	double gnorm = dnrm2_(&n, g, &inc);
+	if (gnorm1 < 0)
+		gnorm1 = gnorm;
+	delta = M.norm(n, g);
 
 	if (gnorm <= eps*gnorm1)
 		search = 0;
@@ -87,20 +231,20 @@ void TRON::tron(double *w)
 
 	while (iter <= max_iter && search)
 	{
-		cg_iter = trcg(delta, g, s, r);
+		cg_iter = trcg(delta, g, M, s, r, d, Hd);
 
-		memcpy(w_new, w, sizeof(double)*n);
-		daxpy_(&n, &one, s, &inc, w_new, &inc);
+		for (i=0; i<n; i++)
+			w_new[i] = w[i] + s[i];
 
-		gs = ddot_(&n, g, &inc, s, &inc);
-		prered = -0.5*(gs-ddot_(&n, s, &inc, r, &inc));
+		dots(n, s, g, r, mul, &gs, &sr, &ss);
+		prered = -0.5*(gs-sr);
                 fnew = fun_obj->fun(w_new);
 
 		// Compute the actual reduction.
 	        actred = f - fnew;
 
 		// On the first iteration, adjust the initial step bound.
-		snorm = dnrm2_(&n, s, &inc);
+		snorm = sqrt(ss);
 		if (iter == 1)
 			delta = min(delta, snorm);
 
@@ -128,6 +272,7 @@ void TRON::tron(double *w)
 			memcpy(w, w_new, sizeof(double)*n);
 			f = fnew;
 		        fun_obj->grad(w, g);
+			M.update(fun_obj);
 
 			gnorm = dnrm2_(&n, g, &inc);
 			if (gnorm <= eps*gnorm1)
@@ -150,73 +295,62 @@ void TRON::tron(double *w)
 			break;
 		}
 	}
-
-	delete[] g;
-	delete[] r;
-	delete[] w_new;
-	delete[] s;
 }
 
-int TRON::trcg(double delta, double *g, double *s, double *r)
+// CG on H s = -g preconditioned by M, within ||s||_M <= delta. rTr is
+// r'M^{-1}r, the d's are M-conjugate directions.
+template <class Metric> int TRON::trcg(double delta, double *g, const Metric &M, double *s, double *r, double *d, double *Hd)
 {
 	int i, inc = 1;
 	int n = fun_obj->get_nr_variable();
-	double one = 1;
-	double *d = new double[n];
-	double *Hd = new double[n];
 	double rTr, rnewTrnew, alpha, beta, cgtol;
+	auto mul = [&](int j, double x) { return M.mul(j, x); };
+	auto div = [&](int j, double x) { return M.div(j, x); };
 
+	rTr = 0;
 	for (i=0; i<n; i++)
 	{
 		s[i] = 0;
 		r[i] = -g[i];
-		d[i] = r[i];
+		d[i] = M.div(i, r[i]);
+		rTr += d[i]*r[i];
 	}
-	cgtol = 0.1*dnrm2_(&n, g, &inc);
+	cgtol = 0.1*sqrt(rTr);
 
 	int cg_iter = 0;
-	rTr = ddot_(&n, r, &inc, r, &inc);
 	while (1)
 	{
-		if (dnrm2_(&n, r, &inc) <= cgtol)
+		if (sqrt(rTr) <= cgtol)
 			break;
 		cg_iter++;
 		fun_obj->Hv(d, Hd);
 
 		alpha = rTr/ddot_(&n, d, &inc, Hd, &inc);
-		daxpy_(&n, &alpha, d, &inc, s, &inc);
-		if (dnrm2_(&n, s, &inc) > delta)
+		if (sqrt(axpy_sqnorm(n, alpha, d, s, mul)) > delta)
 		{
 			info("cg reaches trust region boundary\n");
-			alpha = -alpha;
-			daxpy_(&n, &alpha, d, &inc, s, &inc);
-
-			double std = ddot_(&n, s, &inc, d, &inc);
-			double sts = ddot_(&n, s, &inc, s, &inc);
-			double dtd = ddot_(&n, d, &inc, d, &inc);
+			double std, sts, dtd;
+			axpy_dots(n, -alpha, d, s, mul, &std, &sts, &dtd);
 			double dsq = delta*delta;
 			double rad = sqrt(std*std + dtd*(dsq-sts));
 			if (std >= 0)
 				alpha = (dsq - sts)/(std + rad);
 			else
 				alpha = (rad - std)/dtd;
-			daxpy_(&n, &alpha, d, &inc, s, &inc);
-			alpha = -alpha;
-			daxpy_(&n, &alpha, Hd, &inc, r, &inc);
+			for (i=0; i<n; i++)
+			{
+				s[i] += alpha*d[i];
+				r[i] -= alpha*Hd[i];
+			}
 			break;
 		}
-		alpha = -alpha;
-		daxpy_(&n, &alpha, Hd, &inc, r, &inc);
-		rnewTrnew = ddot_(&n, r, &inc, r, &inc);
+		rnewTrnew = axpy_sqnorm(n, -alpha, Hd, r, div);
 		beta = rnewTrnew/rTr;
-		dscal_(&n, &beta, d, &inc);
-		daxpy_(&n, &one, r, &inc, d, &inc);
+		for (i=0; i<n; i++)
+			d[i] = beta*d[i] + M.div(i, r[i]);
 		rTr = rnewTrnew;
 	}
 
-	delete[] d;
-	delete[] Hd;
-
 	return(cg_iter);
 }
 
@@ -1,12 +1,16 @@
 #ifndef _TRON_H
 #define _TRON_H
 
+#include <stddef.h>
+
 class function
 {
 public:
 	virtual double fun(double *w) = 0 ;
 	virtual void grad(double *w, double *g) = 0 ;
 	virtual void Hv(double *s, double *Hs) = 0 ;
+	// the diagonal of the Hessian at the w of the last grad()
+	virtual void get_diag_preconditioner(double *M) = 0 ;
 
 	virtual int get_nr_variable(void) = 0 ;
 	virtual ~function(void){}
@@ -15,18 +19,25 @@ public:
 class TRON
 {
 public:
-	TRON(const function *fun_obj, double eps = 0.1, int max_iter = 1000);
+	// work, if not NULL, holds the 7*n doubles tron() works in;
+	// otherwise tron() allocates them itself. With precondition, CG is
+	// preconditioned by the Hessian's diagonal.
+	TRON(const function *fun_obj, double eps = 0.1, int max_iter = 1000, double *work = NULL, bool precondition = false);
 	~TRON();
 
+	// minimize fun_obj starting from w, which gets the solution
 	void tron(double *w);
 	void set_print_string(void (*i_print) (const char *buf));
 
 private:
-	int trcg(double delta, double *g, double *s, double *r);
+	template <class Metric> void solve(double *w, Metric &M, double *buf);
+	template <class Metric> int trcg(double delta, double *g, const Metric &M, double *s, double *r, double *d, double *Hd);
 	double norm_inf(int n, double *x);
 
 	double eps;
 	int max_iter;
+	double *work;
+	bool precondition;
 	function *fun_obj;
 	void info(const char *fmt,...);
 	void (*tron_print_string)(const char *buf);